@@ -11,7 +11,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
 #include "pin.H"
 using std::cerr;
 using std::ofstream;
@@ -19,23 +23,266 @@ using std::ios;
 using std::string;
 using std::endl;
 using std::vector;
+using std::ostream;
 
 ofstream OutFile;
 
 // Convenience data structure
 typedef uint32_t reg_t;
+struct RoutineMix;
 struct Registers
 {
+	Registers() : rtn(NULL) {}
 	vector<reg_t> read;
 	vector<reg_t> write;
+	RoutineMix* rtn;	// with -mix, the routine its dependency distances count for
+};
+
+// Log-linear (HDR-style) histogram of dependency distances.
+// Distances below 2^subBits are counted exactly. Above that, every power-of-two
+// range [2^e, 2^(e+1)) is split into 2^(subBits-1) equal sub-buckets, so each
+// bucket's width is at most 2^-(subBits-1) of its lower bound. The bucket array
+// grows with log2(highest), and record() costs one bit scan and one increment.
+class DistanceHistogram
+{
+public:
+	DistanceHistogram(UINT32 subBits, UINT64 highest)
+		: m_subBits(subBits), m_subCount(1ULL << subBits), m_halfCount(1ULL << (subBits - 1)),
+		  m_highest(highest), m_total(0), m_underflow(0), m_overflow(0),
+		  m_min(~0ULL), m_max(0), m_sum(0)
+	{
+		m_bucketNum = bucketIndex(highest) + 1;
+		m_counts = new UINT64[m_bucketNum];
+		memset((void*)m_counts, 0, sizeof(UINT64) * m_bucketNum);
+	}
+
+	~DistanceHistogram() { delete[] m_counts; }
+
+	// Distance 0 (an instruction reading a register it also writes) is an
+	// underflow; anything above the highest trackable value is an overflow.
+	void record(UINT64 value)
+	{
+		m_total++;
+		if (value < 1)
+		{
+			m_underflow++;
+			return;
+		}
+		if (value > m_highest)
+		{
+			m_overflow++;
+			return;
+		}
+		m_counts[bucketIndex(value)]++;
+		if (value < m_min) m_min = value;
+		if (value > m_max) m_max = value;
+		m_sum += (double)value;
+	}
+
+	UINT64 bucketIndex(UINT64 value) const
+	{
+		if (value < m_subCount)
+			return value;
+		UINT32 shift = (63 - __builtin_clzll(value)) - (m_subBits - 1);
+		return m_subCount + (shift - 1) * m_halfCount + ((value >> shift) - m_halfCount);
+	}
+
+	UINT64 bucketLow(UINT64 idx) const
+	{
+		if (idx < m_subCount)
+			return idx;
+		UINT64 shift = (idx - m_subCount) / m_halfCount + 1;
+		return (((idx - m_subCount) % m_halfCount) + m_halfCount) << shift;
+	}
+
+	UINT64 bucketHigh(UINT64 idx) const
+	{
+		if (idx < m_subCount)
+			return idx;
+		UINT64 shift = (idx - m_subCount) / m_halfCount + 1;
+		return bucketLow(idx) + (1ULL << shift) - 1;
+	}
+
+	UINT64 recorded() const { return m_total - m_underflow - m_overflow; }
+	double sum() const { return m_sum; }
+
+	// Highest value equivalent to the bucket holding the q-th quantile of the
+	// in-range samples, clamped to the exact maximum seen.
+	UINT64 percentile(double q) const
+	{
+		UINT64 n = recorded();
+		if (n == 0)
+			return 0;
+		UINT64 rank = (UINT64)(q / 100.0 * n + 0.5);
+		if (rank < 1) rank = 1;
+		if (rank > n) rank = n;
+		UINT64 seen = 0;
+		for (UINT64 i = 0; i < m_bucketNum; i++)
+		{
+			seen += m_counts[i];
+			if (seen >= rank)
+				return bucketHigh(i) < m_max ? bucketHigh(i) : m_max;
+		}
+		return m_max;
+	}
+
+	void writeJson(ostream& os) const;
+	void writeCsv(ostream& os) const;
+
+private:
+	UINT32 m_subBits;
+	UINT64 m_subCount;      // Exactly counted values: [0, 2^subBits)
+	UINT64 m_halfCount;     // Sub-buckets per power-of-two range above that
+	UINT64 m_highest;       // Highest trackable distance
+	UINT64 m_bucketNum;
+	UINT64* m_counts;
+
+	UINT64 m_total;
+	UINT64 m_underflow;
+	UINT64 m_overflow;
+	UINT64 m_min;
+	UINT64 m_max;
+	double m_sum;
+};
+
+static const double kPercentiles[] = { 50, 90, 99, 99.9 };
+static const char* kPercentileNames[] = { "p50", "p90", "p99", "p99_9" };
+static const UINT32 kPercentileNum = sizeof(kPercentiles) / sizeof(kPercentiles[0]);
+
+void DistanceHistogram::writeJson(ostream& os) const
+{
+	UINT64 n = recorded();
+	os << "{" << endl;
+	os << "  \"tool\": \"insDependDist\"," << endl;
+	os << "  \"precision_bits\": " << m_subBits << "," << endl;
+	os << "  \"highest_trackable\": " << m_highest << "," << endl;
+	os << "  \"total\": " << m_total << "," << endl;
+	os << "  \"recorded\": " << n << "," << endl;
+	os << "  \"underflow\": " << m_underflow << "," << endl;
+	os << "  \"overflow\": " << m_overflow << "," << endl;
+	os << "  \"min\": " << (n ? m_min : 0) << "," << endl;
+	os << "  \"max\": " << m_max << "," << endl;
+	os << "  \"mean\": " << (n ? m_sum / n : 0.0) << "," << endl;
+	os << "  \"percentiles\": {";
+	for (UINT32 i = 0; i < kPercentileNum; i++)
+		os << (i ? ", " : " ") << "\"" << kPercentileNames[i] << "\": " << percentile(kPercentiles[i]);
+	os << " }," << endl;
+	os << "  \"buckets\": [";
+	bool first = true;
+	for (UINT64 i = 0; i < m_bucketNum; i++)
+	{
+		if (m_counts[i] == 0)
+			continue;
+		os << (first ? "" : ",") << endl
+		   << "    { \"lo\": " << bucketLow(i) << ", \"hi\": " << bucketHigh(i)
+		   << ", \"count\": " << m_counts[i] << " }";
+		first = false;
+	}
+	os << endl << "  ]" << endl << "}" << endl;
+}
+
+// Long-format CSV: one "summary" row per statistic, one "bucket" row per
+// non-empty bucket, all under the same header.
+void DistanceHistogram::writeCsv(ostream& os) const
+{
+	UINT64 n = recorded();
+	os << "type,name,lo,hi,value" << endl;
+	os << "summary,precision_bits,,," << m_subBits << endl;
+	os << "summary,highest_trackable,,," << m_highest << endl;
+	os << "summary,total,,," << m_total << endl;
+	os << "summary,recorded,,," << n << endl;
+	os << "summary,underflow,,," << m_underflow << endl;
+	os << "summary,overflow,,," << m_overflow << endl;
+	os << "summary,min,,," << (n ? m_min : 0) << endl;
+	os << "summary,max,,," << m_max << endl;
+	os << "summary,mean,,," << (n ? m_sum / n : 0.0) << endl;
+	for (UINT32 i = 0; i < kPercentileNum; i++)
+		os << "summary," << kPercentileNames[i] << ",,," << percentile(kPercentiles[i]) << endl;
+	for (UINT64 i = 0; i < m_bucketNum; i++)
+	{
+		if (m_counts[i] == 0)
+			continue;
+		os << "bucket,," << bucketLow(i) << "," << bucketHigh(i) << "," << m_counts[i] << endl;
+	}
+}
+
+/* ===================================================================== */
+/* Instruction Mix                                                       */
+/* ===================================================================== */
+// With -mix every instruction is put in one operation class, and loads and
+// stores are counted on the side since an x86 instruction can compute and
+// access memory at once. A basic block's static mix is fixed when it is
+// instrumented; each thread counts the executions of each block in its own
+// TLS array, and Fini merges the threads into rows for each thread, the
+// busiest routines and the whole run, with a throughput estimate on a
+// simple MIX_WIDTH-wide core. A row's cycles are the largest of
+//   front end:    each block is fetched in ceil(instructions/width) cycles
+//   dependencies: ILP is the mean dependency distance of the row, clamped
+//                 to [1, width]; instructions/ILP cycles
+//   port groups:  the operations of each group over its rate
+// Of the row's width*cycles issue slots, retiring is the share that issues
+// instructions, front-end bound the share left empty by blocks that end
+// mid fetch group, and back-end bound the rest, lost to busy ports or
+// dependencies. Dependency distances are measured across all threads, so
+// thread rows have no dependency bound.
+#define MIX_WIDTH 4			// instructions issued per cycle
+
+enum MixClass
+{
+	MIX_LOAD, MIX_STORE,	// memory accesses, on top of the operation class
+	MIX_BRANCH, MIX_INT, MIX_DIV, MIX_FP, MIX_SIMD128, MIX_SIMD256, MIX_SIMD512, MIX_MOVE, MIX_OTHER,
+	MIX_CLASSES
+};
+static const char* kMixNames[MIX_CLASSES] =
+	{ "load", "store", "branch", "int", "div", "fp", "simd128", "simd256", "simd512", "move", "other" };
+
+// Operations per cycle of each port group: 4 integer ALUs, 2 branch units,
+// 2 vector/FP units that 512-bit operations take both of, a divider busy
+// for 4 cycles per divide or square root, 2 load ports and 1 store port
+enum PortGroup { PORT_ALU, PORT_BRANCH, PORT_VEC, PORT_DIV, PORT_LOAD, PORT_STORE, PORT_GROUPS };
+static const char* kPortNames[PORT_GROUPS] = { "alu", "branch", "vec", "div", "load", "store" };
+static const double kPortRate[PORT_GROUPS] = { 4, 2, 2, 0.25, 2, 1 };
+
+// Dynamic counts of a thread, routine or the whole run
+struct MixCounts
+{
+	MixCounts() : ins(0), fetch(0) { memset(counts, 0, sizeof(counts)); }
+	UINT64 counts[MIX_CLASSES];
+	UINT64 ins;
+	UINT64 fetch;		// front-end cycles
+};
+
+struct RoutineMix
+{
+	RoutineMix() : depSum(0), depCount(0) {}
+	string name;
+	MixCounts mix;
+	double depSum;		// of the dependency distances its instructions read
+	UINT64 depCount;
+};
+
+// Static mix of a basic block
+struct BlockMix
+{
+	RoutineMix* rtn;
+	UINT32 counts[MIX_CLASSES];
+	UINT32 ins;
+	UINT32 fetch;
+
+	void addTo(MixCounts& m, UINT64 executions) const
+	{
+		for (UINT32 c = 0; c < MIX_CLASSES; c++)
+			m.counts[c] += counts[c] * executions;
+		m.ins += ins * executions;
+		m.fetch += fetch * executions;
+	}
 };
 
 // Global variables
-// The array storing the distance frequency between two dependant instructions
-UINT64 *insDependDistance;
-INT32 maxSize;
-INT32 insPointer = 0;
-INT32 lastInsPointer[1024] = { 0 };
+// The histogram storing the distance frequency between two dependant instructions
+DistanceHistogram *insDependDistance;
+UINT64 insPointer = 0;
+UINT64 lastInsPointer[1024] = { 0 };
 
 // This function is called before every instruction is executed. 
 // You have to edit this function to determine the dependency distance
@@ -70,17 +317,21 @@ VOID updateInsDependDistance(VOID *v)
 		if (lastInsPointer[reg] > 0)
 		{
 			// Compute the dependency distance
-			INT32 distance = insPointer - lastInsPointer[reg];// TODO
+			UINT64 distance = insPointer - lastInsPointer[reg];// TODO
 
-			// Populate the insDependDistance array
-			if (distance <= maxSize)
-				insDependDistance[distance-1]++;// TODO
+			// Populate the insDependDistance histogram
+			insDependDistance->record(distance);// TODO
+			if (regs->rtn && distance > 0)
+			{
+				regs->rtn->depSum += distance;
+				regs->rtn->depCount++;
+			}
 		}
 	}
 }
 
-// Pin calls this function every time a new instruction is encountered
-VOID Instruction(INS ins, VOID *v)
+// The registers read and written by ins, for updateInsDependDistance
+Registers* insRegisters(INS ins)
 {
 	// regs stores the registers read, written by this instruction
 	Registers* regs = new Registers();
@@ -113,6 +364,213 @@ VOID Instruction(INS ins, VOID *v)
 		if (std::find(regs->read.begin(), regs->read.end(), rr) == regs->read.end())
 			regs->read.push_back(rr);
 	}
+	return regs;
+}
+
+#ifndef UNIFIED_TOOL
+// These knobs turn on the instruction mix; see the Instruction Mix section
+KNOB<string> KnobMixFile(KNOB_MODE_WRITEONCE, "pintool", "mix", "", "write the instruction mix, port pressure and bound fractions per thread and routine to this file");
+
+KNOB<UINT32> KnobMixTop(KNOB_MODE_WRITEONCE, "pintool", "mixtop", "20", "specify the number of routines in the -mix file");
+
+ofstream MixOut;
+vector<BlockMix*> mixBlocks;				// by block id
+std::map<ADDRINT, RoutineMix*> mixRoutines;	// by routine address, 0 if unknown
+TLS_KEY mixKey;
+PIN_LOCK mixLock;
+
+// Executions of each block by one thread, by block id
+struct ThreadMix
+{
+	THREADID tid;
+	vector<UINT64> blocks;
+};
+vector<ThreadMix*> mixThreads;
+
+// Operation class of ins, from its opcode, XED category and register operands
+MixClass mixClass(INS ins)
+{
+	if (INS_IsControlFlow(ins))
+		return MIX_BRANCH;
+	// Covers the integer, x87, scalar and packed forms
+	string opcode = OPCODE_StringShort(INS_Opcode(ins));
+	if (opcode.find("DIV") != string::npos || opcode.find("SQRT") != string::npos)
+		return MIX_DIV;
+
+	UINT32 category = INS_Category(ins);
+	if (category == XED_CATEGORY_DATAXFER || category == XED_CATEGORY_PUSH || category == XED_CATEGORY_POP
+		|| category == XED_CATEGORY_STRINGOP)
+		return MIX_MOVE;
+
+	// Width of the widest vector register operand
+	UINT32 width = 0;
+	for (UINT32 i = 0; i < INS_OperandCount(ins); i++)
+	{
+		if (!INS_OperandIsReg(ins, i))
+			continue;
+		REG reg = INS_OperandReg(ins, i);
+		if (REG_is_zmm(reg)) width = 512;
+		else if (REG_is_ymm(reg) && width < 256) width = 256;
+		else if (REG_is_xmm(reg) && width < 128) width = 128;
+	}
+	if (width)
+	{
+		if (xed_decoded_inst_get_attribute(INS_XedDec(ins), XED_ATTRIBUTE_SIMD_SCALAR))
+			return MIX_FP;
+		return width == 512 ? MIX_SIMD512 : width == 256 ? MIX_SIMD256 : MIX_SIMD128;
+	}
+	if (category == XED_CATEGORY_X87_ALU)
+		return MIX_FP;
+	if (category == XED_CATEGORY_NOP || category == XED_CATEGORY_WIDENOP || category == XED_CATEGORY_SYSCALL
+		|| category == XED_CATEGORY_SYSTEM || category == XED_CATEGORY_INTERRUPT || category == XED_CATEGORY_MISC)
+		return MIX_OTHER;
+	return MIX_INT;
+}
+
+RoutineMix* routineMix(ADDRINT addr)
+{
+	RTN rtn = RTN_FindByAddress(addr);
+	RoutineMix*& mix = mixRoutines[RTN_Valid(rtn) ? RTN_Address(rtn) : 0];
+	if (!mix)
+	{
+		mix = new RoutineMix;
+		mix->name = RTN_Valid(rtn) ? RTN_Name(rtn) : "[unknown]";
+	}
+	return mix;
+}
+
+// This function is called at every basic block entry with -mix
+VOID countMixBlock(UINT32 id, THREADID tid)
+{
+	ThreadMix* t = (ThreadMix*)PIN_GetThreadData(mixKey, tid);
+	if (id >= t->blocks.size())
+		t->blocks.resize(id + 1024, 0);
+	t->blocks[id]++;
+}
+
+// Pin calls this function for every new trace with -mix
+VOID MixTrace(TRACE trace, VOID *v)
+{
+	for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+	{
+		BlockMix* b = new BlockMix();
+		b->rtn = routineMix(BBL_Address(bbl));
+		for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+		{
+			b->counts[mixClass(ins)]++;
+			if (INS_IsMemoryRead(ins)) b->counts[MIX_LOAD]++;
+			if (INS_IsMemoryWrite(ins)) b->counts[MIX_STORE]++;
+		}
+		b->ins = BBL_NumIns(bbl);
+		b->fetch = (b->ins + MIX_WIDTH - 1) / MIX_WIDTH;
+		BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countMixBlock,
+					   IARG_UINT32, (UINT32)mixBlocks.size(), IARG_THREAD_ID, IARG_END);
+		mixBlocks.push_back(b);
+	}
+}
+
+// Pin calls this function when a thread starts, with -mix
+VOID MixThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+	ThreadMix* t = new ThreadMix;
+	t->tid = tid;
+	PIN_SetThreadData(mixKey, t, tid);
+	PIN_GetLock(&mixLock, tid + 1);
+	mixThreads.push_back(t);
+	PIN_ReleaseLock(&mixLock);
+}
+
+// One row of the -mix file; without dependency distances (depCount 0)
+// there is no dependency bound
+void writeMixRow(const string& scope, const string& name, const MixCounts& m, double depSum, UINT64 depCount)
+{
+	if (m.ins == 0)
+		return;
+	double ports[PORT_GROUPS];
+	ports[PORT_ALU] = (m.counts[MIX_INT] + m.counts[MIX_OTHER]) / kPortRate[PORT_ALU];
+	ports[PORT_BRANCH] = m.counts[MIX_BRANCH] / kPortRate[PORT_BRANCH];
+	ports[PORT_VEC] = (m.counts[MIX_FP] + m.counts[MIX_SIMD128] + m.counts[MIX_SIMD256] + 2.0 * m.counts[MIX_SIMD512])
+					  / kPortRate[PORT_VEC];
+	ports[PORT_DIV] = m.counts[MIX_DIV] / kPortRate[PORT_DIV];
+	ports[PORT_LOAD] = m.counts[MIX_LOAD] / kPortRate[PORT_LOAD];
+	ports[PORT_STORE] = m.counts[MIX_STORE] / kPortRate[PORT_STORE];
+
+	double depMean = depCount ? depSum / depCount : 0;
+	double ilp = depCount ? std::min(std::max(depMean, 1.0), (double)MIX_WIDTH) : MIX_WIDTH;
+	double cycles = std::max((double)m.fetch, m.ins / ilp);
+	UINT32 hot = 0;
+	for (UINT32 p = 0; p < PORT_GROUPS; p++)
+	{
+		cycles = std::max(cycles, ports[p]);
+		if (ports[p] > ports[hot]) hot = p;
+	}
+	double slots = MIX_WIDTH * cycles;
+	double packed = m.counts[MIX_SIMD128] + m.counts[MIX_SIMD256] + m.counts[MIX_SIMD512];
+
+	MixOut << scope << "," << name << "," << m.ins;
+	for (UINT32 c = 0; c < MIX_CLASSES; c++)
+		MixOut << "," << m.counts[c];
+	MixOut << "," << (packed ? packed / (packed + m.counts[MIX_FP]) : 0.0) << ",";
+	if (depCount)
+		MixOut << depMean;
+	MixOut << "," << ilp;
+	for (UINT32 p = 0; p < PORT_GROUPS; p++)
+		MixOut << "," << ports[p] / cycles;
+	MixOut << "," << kPortNames[hot] << "," << m.ins / slots << "," << (MIX_WIDTH * m.fetch - m.ins) / slots
+		   << "," << 1 - MIX_WIDTH * m.fetch / slots << endl;
+}
+
+static bool busierRoutine(const RoutineMix* a, const RoutineMix* b)
+{
+	return a->mix.ins > b->mix.ins;
+}
+
+// Merge the threads' counts and write the -mix file: a row per thread, the
+// -mixtop routines with the most instructions, then the whole run
+void dumpMix()
+{
+	MixOut << "scope,name,instructions";
+	for (UINT32 c = 0; c < MIX_CLASSES; c++)
+		MixOut << "," << kMixNames[c];
+	MixOut << ",vector_ratio,dep_mean,ilp";
+	for (UINT32 p = 0; p < PORT_GROUPS; p++)
+		MixOut << ",port_" << kPortNames[p];
+	MixOut << ",busiest_port,retiring,frontend_bound,backend_bound" << endl;
+
+	MixCounts total;
+	for (size_t i = 0; i < mixThreads.size(); i++)
+	{
+		ThreadMix* t = mixThreads[i];
+		MixCounts thread;
+		for (size_t id = 0; id < t->blocks.size(); id++)
+		{
+			if (t->blocks[id] == 0)
+				continue;
+			mixBlocks[id]->addTo(thread, t->blocks[id]);
+			mixBlocks[id]->addTo(mixBlocks[id]->rtn->mix, t->blocks[id]);
+			mixBlocks[id]->addTo(total, t->blocks[id]);
+		}
+		std::ostringstream tid;
+		tid << t->tid;
+		writeMixRow("thread", tid.str(), thread, 0, 0);
+	}
+
+	vector<RoutineMix*> routines;
+	for (std::map<ADDRINT, RoutineMix*>::iterator it = mixRoutines.begin(); it != mixRoutines.end(); it++)
+		routines.push_back(it->second);
+	std::sort(routines.begin(), routines.end(), busierRoutine);
+	for (size_t i = 0; i < routines.size() && i < KnobMixTop.Value(); i++)
+		writeMixRow("routine", routines[i]->name, routines[i]->mix, routines[i]->depSum, routines[i]->depCount);
+
+	writeMixRow("total", "", total, insDependDistance->sum(), insDependDistance->recorded());
+}
+
+// Pin calls this function every time a new instruction is encountered
+VOID Instruction(INS ins, VOID *v)
+{
+	Registers* regs = insRegisters(ins);
+	if (!KnobMixFile.Value().empty())
+		regs->rtn = routineMix(INS_Address(ins));
 
 	// Insert a call to the analysis function -- updateInsDependDistance -- before every instruction.
 	// Pass the regs structure to the analysis function.
@@ -121,20 +579,54 @@ VOID Instruction(INS ins, VOID *v)
 
 // This knob sets the output file name
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "insDependDist.csv", "specify the output file name");
+#endif
+
+// This knob will set the maximum distance between two dependant instructions in the program.
+// Larger distances are reported as overflow; memory grows only with log2 of this value.
+KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "4294967296", "specify the maximum distance between two dependant instructions in the program");
 
-// This knob will set the maximum distance between two dependant instructions in the program
-KNOB<string> KnobMaxDistance(KNOB_MODE_WRITEONCE, "pintool", "s", "100", "specify the maximum distance between two dependant instructions in the program");
+// This knob sets the histogram precision: distances below 2^p are exact
+KNOB<UINT32> KnobPrecisionBits(KNOB_MODE_WRITEONCE, "pintool", "p", "7", "specify the number of histogram precision bits (2..16)");
+
+// This knob sets the output format
+KNOB<string> KnobOutputFormat(KNOB_MODE_WRITEONCE, "pintool", "f", "csv", "specify the output format: csv or json");
 
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
 	// Write to a file since cout and cerr maybe closed by the application
-    OutFile.setf(ios::showbase);
-    for (INT32 i = 0; i < maxSize; i++)
-	    OutFile << insDependDistance[i] << ",";
+    if (KnobOutputFormat.Value() == "json")
+        insDependDistance->writeJson(OutFile);
+    else
+        insDependDistance->writeCsv(OutFile);
     OutFile.close();
+#ifndef UNIFIED_TOOL
+    if (!KnobMixFile.Value().empty())
+    {
+        dumpMix();
+        MixOut.close();
+    }
+#endif
 }
 
+// Check the knobs, open the output file and create the histogram
+BOOL initDependDist()
+{
+    UINT64 maxSize = strtoull(KnobMaxDistance.Value().c_str(), NULL, 10);
+    UINT32 precision = KnobPrecisionBits.Value();
+    if (maxSize < 1 || precision < 2 || precision > 16)
+        return FALSE;
+    if (KnobOutputFormat.Value() != "csv" && KnobOutputFormat.Value() != "json")
+        return FALSE;
+
+    OutFile.open(KnobOutputFile.Value().c_str());
+
+    // Initializing depdendancy Distance
+    insDependDistance = new DistanceHistogram(precision, maxSize);
+    return TRUE;
+}
+
+#ifndef UNIFIED_TOOL
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -155,17 +647,20 @@ INT32 Usage()
 int main(int argc, char * argv[])
 {
     // Initialize pin
-    if (PIN_Init(argc, argv)) return Usage();
-    
-    OutFile.open(KnobOutputFile.Value().c_str());
-    maxSize = atoi(KnobMaxDistance.Value().c_str());
-
-    // Initializing depdendancy Distance
-    insDependDistance = new UINT64[maxSize];
-    memset((void*)insDependDistance, 0, sizeof(UINT64) * maxSize);
+    if (PIN_Init(argc, argv) || !initDependDist()) return Usage();
 
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
+    if (!KnobMixFile.Value().empty())
+    {
+        // Symbols name the routines
+        PIN_InitSymbols();
+        MixOut.open(KnobMixFile.Value().c_str());
+        mixKey = PIN_CreateThreadDataKey(NULL);
+        PIN_InitLock(&mixLock);
+        TRACE_AddInstrumentFunction(MixTrace, 0);
+        PIN_AddThreadStartFunction(MixThreadStart, 0);
+    }
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
@@ -175,4 +670,5 @@ int main(int argc, char * argv[])
     
     return 0;
 }
+#endif
 
@@ -1,9 +1,14 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "pin.H"
+#include "../common/intervalLog.h"
+#include "../common/checkpoint.h"
 
 using namespace std;
 
@@ -57,6 +62,11 @@ class BranchPredictor
         BranchPredictor() { }
         virtual BOOL predict(ADDRINT addr) { return FALSE; };
         virtual void update(BOOL takenActually, BOOL takenPredicted, ADDRINT addr) {};
+
+        // The predictor and its parameters, checked when a checkpoint is restored
+        virtual string describe() { return "static"; }
+        // Save or restore the prediction tables
+        virtual void transfer(CheckpointState& state) { }
 };
 
 BranchPredictor* BP;
@@ -91,6 +101,15 @@ class BHTPredictor: public BranchPredictor
 		else
 			counter[index].decrease();
         }
+
+        string describe()
+        {
+            ostringstream s;
+            s << "BHT " << L;
+            return s.str();
+        }
+
+        void transfer(CheckpointState& state) { state.transfer(counter, sizeof(counter)); }
 };
 
 // 2. Global-history-based branch predictor
@@ -123,6 +142,19 @@ class GlobalHistoryPredictor: public BranchPredictor
 			bhist[index].decrease();
 		GHR.shiftIn(takenActually);
         }
+
+        string describe()
+        {
+            ostringstream s;
+            s << "GlobalHistory " << L << " " << H << " " << BITS;
+            return s.str();
+        }
+
+        void transfer(CheckpointState& state)
+        {
+            state.transfer(bhist, sizeof(bhist));
+            state.transfer(&GHR, sizeof(GHR));
+        }
 };
 
 // 3. Local-history-based branch predictor
@@ -157,6 +189,19 @@ class LocalHistoryPredictor: public BranchPredictor
 			bhist[tag].decrease();
 		LHT[index].shiftIn(takenActually);
         }
+
+        string describe()
+        {
+            ostringstream s;
+            s << "LocalHistory " << L << " " << H << " " << HL << " " << BITS;
+            return s.str();
+        }
+
+        void transfer(CheckpointState& state)
+        {
+            state.transfer(bhist, sizeof(bhist));
+            state.transfer(LHT, sizeof(LHT));
+        }
 };
 
 /* ===================================================================== */
@@ -196,6 +241,20 @@ class TournamentPredictor_GSH: public BranchPredictor
 		BPs[0]->update(takenActually, takenPredicted, addr);
 		BPs[1]->update(takenActually, takenPredicted, addr);
         }
+
+        string describe()
+        {
+            ostringstream s;
+            s << "Tournament_GSH " << BITS << " (" << BPs[0]->describe() << ", " << BPs[1]->describe() << ")";
+            return s.str();
+        }
+
+        void transfer(CheckpointState& state)
+        {
+            state.transfer(&GSHR, sizeof(GSHR));
+            BPs[0]->transfer(state);
+            BPs[1]->transfer(state);
+        }
 };
 
 // 2. Tournament predictor: Select output by local selection history
@@ -213,6 +272,20 @@ class TournamentPredictor_LSH: public BranchPredictor
         }
 
         // TODO:
+
+        string describe()
+        {
+            ostringstream s;
+            s << "Tournament_LSH " << L << " " << BITS << " (" << BPs[0]->describe() << ", " << BPs[1]->describe() << ")";
+            return s.str();
+        }
+
+        void transfer(CheckpointState& state)
+        {
+            state.transfer(LSHT, sizeof(LSHT));
+            BPs[0]->transfer(state);
+            BPs[1]->transfer(state);
+        }
 };
 
 // This function is called every time a control-flow instruction is encountered
@@ -236,6 +309,7 @@ void predictBranch(ADDRINT pc, BOOL direction)
     }
 }
 
+#ifndef UNIFIED_TOOL
 // Pin calls this function every time a new instruction is encountered
 void Instruction(INS ins, void * v)
 {
@@ -251,6 +325,95 @@ void Instruction(INS ins, void * v)
 
 // This knob sets the output file name
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "brchPredict.txt", "specify the output file name");
+#endif
+
+// These knobs start the predictor from a checkpoint and save one at the end
+KNOB<string> KnobLoadPredictor(KNOB_MODE_WRITEONCE, "pintool", "loadbp", "", "start the predictor from a checkpoint written by -savebp");
+
+KNOB<string> KnobSavePredictor(KNOB_MODE_WRITEONCE, "pintool", "savebp", "", "write the predictor tables to a checkpoint when the application exits");
+
+KNOB<BOOL> KnobKeepPredictorStats(KNOB_MODE_WRITEONCE, "pintool", "keepbpstats", "0", "continue the prediction counters of -loadbp instead of starting from zero");
+
+/* ===================================================================== */
+/* Checkpoints                                                           */
+/* ===================================================================== */
+// A checkpoint (see checkpoint.h) holds the predictor after a run, so
+// later runs start from its warm tables: the describe() string of the
+// predictor, the four prediction counters, then the tables in transfer()
+// order. A checkpoint of another version or of another predictor is
+// refused.
+#define BP_CKPT_MAGIC "BPREDCKP"
+#define BP_CKPT_VERSION 1
+
+// Save the predictor to state or restore it from it, then close it
+bool transferBrchCheckpoint(CheckpointState& state, bool keep_stats)
+{
+    string describe = BP->describe();
+    UINT64 counters[4] = { takenCorrect, takenIncorrect, notTakenCorrect, notTakenIncorrect };
+    bool restoring = !state.saving();
+    state.header(BP_CKPT_MAGIC, BP_CKPT_VERSION, describe.size());
+    state.match(describe);
+    state.transfer(counters, sizeof(counters));
+    BP->transfer(state);
+    if (!state.close()) return false;
+    if (restoring && keep_stats)
+    {
+        takenCorrect = counters[0];
+        takenIncorrect = counters[1];
+        notTakenCorrect = counters[2];
+        notTakenIncorrect = counters[3];
+    }
+    return true;
+}
+
+bool saveBrchCheckpoint(const string& path)
+{
+    CheckpointState state;
+    return state.save(path) && transferBrchCheckpoint(state, false);
+}
+
+bool loadBrchCheckpoint(const string& path, bool keep_stats)
+{
+    CheckpointState state;
+    return state.restore(path) && transferBrchCheckpoint(state, keep_stats);
+}
+
+/* ===================================================================== */
+/* Interval Statistics                                                   */
+/* ===================================================================== */
+// The -interval rows (see intervalLog.h) carry the branches and
+// mispredictions of each interval, so phases with many mispredictions show
+// up that the totals of Fini hide.
+UINT64 row_branches = 0;        // counters when the last row was written
+UINT64 row_mispredicts = 0;
+
+// Columns of the predictor: branches, misprediction rate (%) and
+// mispredictions per thousand instructions
+string brchIntervalHeader()
+{
+    return ",branches,mispredict_rate,branch_mpki";
+}
+
+// Append the columns of the predictor for an interval of ins instructions
+// to row and start the next interval
+int brchIntervalColumns(char* row, int size, UINT64 ins)
+{
+    UINT64 mispredicts = takenIncorrect + notTakenIncorrect;
+    UINT64 branches = takenCorrect + notTakenCorrect + mispredicts;
+    UINT64 d_branches = branches - row_branches;
+    UINT64 d_mispredicts = mispredicts - row_mispredicts;
+    row_branches = branches;
+    row_mispredicts = mispredicts;
+    return snprintf(row, size, ",%lu,%.2f,%.3f", d_branches,
+                    d_branches ? 100.0 * d_mispredicts / d_branches : 0.0,
+                    ins ? 1000.0 * d_mispredicts / ins : 0.0);
+}
+
+void startBrchIntervals()
+{
+    row_mispredicts = takenIncorrect + notTakenIncorrect;
+    row_branches = takenCorrect + notTakenCorrect + row_mispredicts;
+}
 
 // This function is called when the application exits
 VOID Fini(int, VOID * v)
@@ -271,8 +434,32 @@ VOID Fini(int, VOID * v)
     	<< "Precision: " << precision << endl;
     
     OutFile.close();
+
+    closeIntervalLog();
+    if (!KnobSavePredictor.Value().empty() && !saveBrchCheckpoint(KnobSavePredictor.Value()))
+        cerr << "cannot write the checkpoint " << KnobSavePredictor.Value() << endl;
 }
 
+// Create the predictor, restore it with -loadbp and open the output file
+BOOL initBrchPredict()
+{
+    // TODO: New your Predictor below.
+    // BP = new BranchPredictor();
+    BP = new BHTPredictor<16>();
+    //	BP = new TournamentPredictor_GSH<>(new GlobalHistoryPredictor<16,16>(), new LocalHistoryPredictor<16,3>());
+
+    if (!KnobLoadPredictor.Value().empty() && !loadBrchCheckpoint(KnobLoadPredictor.Value(), KnobKeepPredictorStats.Value()))
+    {
+        cerr << "cannot load a checkpoint of " << BP->describe() << " from " << KnobLoadPredictor.Value() << endl;
+        return FALSE;
+    }
+
+    startBrchIntervals();
+    OutFile.open(KnobOutputFile.Value().c_str());
+    return TRUE;
+}
+
+#ifndef UNIFIED_TOOL
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -292,17 +479,18 @@ INT32 Usage()
 
 int main(int argc, char * argv[])
 {
-    // TODO: New your Predictor below.
-    // BP = new BranchPredictor();
-    BP = new BHTPredictor<16>();
-    //	BP = new TournamentPredictor_GSH<>(new GlobalHistoryPredictor<16,16>(), new LocalHistoryPredictor<16,3>());
     // Initialize pin
-    if (PIN_Init(argc, argv)) return Usage();
-    
-    OutFile.open(KnobOutputFile.Value().c_str());
+    if (PIN_Init(argc, argv) || !initBrchPredict()) return Usage();
+
+    if (KnobInterval.Value() && !openIntervalLog(brchIntervalHeader(), brchIntervalColumns)) return 1;
 
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
+    if (interval_log)
+    {
+        TRACE_AddInstrumentFunction(IntervalTrace, 0);
+        PIN_AddPrepareForFiniFunction(IntervalPrepareForFini, 0);
+    }
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
@@ -312,3 +500,4 @@ int main(int argc, char * argv[])
 
     return 0;
 }
+#endif
@@ -1,19 +1,401 @@
 #include <cstdio>
 #include <cmath>
 #include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <deque>
+#include <map>
+#include <algorithm>
 #include "pin.H"
+#include "../common/intervalLog.h"
+#include "../common/checkpoint.h"
+
+/**************************************
+ * Prefetcher Base Class
+**************************************/
+// A prefetcher watches the demand accesses of the cache it is attached to
+// and names the blocks to fetch ahead. The cache issues, delays and fills
+// them and keeps the statistics (see CacheModel::attachPrefetcher).
+class Prefetcher
+{
+public:
+    Prefetcher(UINT32 degree) : m_degree(degree), m_blksz_log(6) {}
+    virtual ~Prefetcher() {}
+
+    virtual const char* name() = 0;
+
+    // Called by CacheModel::attachPrefetcher
+    void setBlockSizeLog(UINT32 log_block_size) { m_blksz_log = log_block_size; }
+
+    // Observe a demand access by the instruction at pc. trigger is set on a
+    // miss and on the first hit to a prefetched block, so a prefetched
+    // stream keeps running ahead. Block addresses (addr >> block size log)
+    // to prefetch are appended to blocks.
+    virtual void train(UINT32 pc, UINT32 mem_addr, bool trigger, std::vector<UINT32>& blocks) = 0;
+
+protected:
+    UINT32 m_degree;        // blocks, strides or stream depth to run ahead
+    UINT32 m_blksz_log;
+};
+
+// Tagged next-N-line prefetcher: a trigger fetches the following degree blocks
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+    NextLinePrefetcher(UINT32 degree) : Prefetcher(degree) {}
+
+    const char* name() { return "next-line"; }
+
+    void train(UINT32 pc, UINT32 mem_addr, bool trigger, std::vector<UINT32>& blocks)
+    {
+        if (!trigger) return;
+        for (UINT32 i = 1; i <= m_degree; i++)
+            blocks.push_back((mem_addr >> m_blksz_log) + i);
+    }
+};
+
+// Reference prediction table (Chen and Baer): a direct-mapped table indexed
+// by the PC of the load or store remembers its last address and stride.
+// Once the same stride is seen twice in a row the entry is steady and the
+// next degree strides are prefetched; strides shorter than a block step a
+// block at a time in the same direction.
+class StridePrefetcher : public Prefetcher
+{
+public:
+    StridePrefetcher(UINT32 degree, UINT32 entries = 256)
+        : Prefetcher(degree), m_table(entries) {}
+
+    const char* name() { return "stride"; }
+
+    void train(UINT32 pc, UINT32 mem_addr, bool trigger, std::vector<UINT32>& blocks)
+    {
+        Entry& e = m_table[pc % m_table.size()];
+        if (!e.valid || e.pc != pc)
+        {
+            e.valid = true;
+            e.pc = pc;
+            e.last = mem_addr;
+            e.stride = 0;
+            e.state = INIT;
+            return;
+        }
+
+        INT32 stride = (INT32)(mem_addr - e.last);
+        bool correct = stride == e.stride;
+        switch (e.state)
+        {
+        case INIT:      e.state = correct ? STEADY : TRANSIENT; break;
+        case TRANSIENT: e.state = correct ? STEADY : NO_PRED; break;
+        case STEADY:    e.state = correct ? STEADY : INIT; break;
+        case NO_PRED:   e.state = correct ? TRANSIENT : NO_PRED; break;
+        }
+        if (!correct && e.state != INIT) e.stride = stride;
+        e.last = mem_addr;
+        if (e.state != STEADY || e.stride == 0) return;
+
+        INT32 blksz = 1 << m_blksz_log;
+        INT32 step = e.stride;
+        if (step > -blksz && step < blksz) step = step > 0 ? blksz : -blksz;
+        UINT32 prev = mem_addr >> m_blksz_log;
+        for (UINT32 i = 1; i <= m_degree; i++)
+        {
+            UINT32 blk = (mem_addr + step * (INT32)i) >> m_blksz_log;
+            if (blk != prev) blocks.push_back(blk);
+            prev = blk;
+        }
+    }
+
+private:
+    enum State { INIT, TRANSIENT, STEADY, NO_PRED };
+
+    struct Entry
+    {
+        Entry() : valid(false), pc(0), last(0), stride(0), state(INIT) {}
+        bool valid;
+        UINT32 pc;
+        UINT32 last;        // last address accessed by pc
+        INT32 stride;
+        State state;
+    };
+
+    std::vector<Entry> m_table;
+};
+
+// Stream buffers (Jouppi): each buffer follows one sequential stream,
+// ascending or descending, and keeps the next degree blocks of it
+// prefetched. A trigger inside a buffer's window advances that buffer;
+// any other trigger reallocates the least recently used buffer at the
+// missing block. Prefetched blocks are filled into the cache itself rather
+// than held beside it, so they are counted like the other prefetchers'.
+class StreamPrefetcher : public Prefetcher
+{
+public:
+    StreamPrefetcher(UINT32 degree, UINT32 streams = 8)
+        : Prefetcher(degree), m_streams(streams), m_last_miss(0), m_time(0) {}
+
+    const char* name() { return "stream"; }
+
+    void train(UINT32 pc, UINT32 mem_addr, bool trigger, std::vector<UINT32>& blocks)
+    {
+        if (!trigger) return;
+        UINT32 blk = mem_addr >> m_blksz_log;
+        m_time++;
+
+        Stream* s = NULL;
+        for (size_t i = 0; i < m_streams.size() && !s; i++)
+        {
+            Stream& t = m_streams[i];
+            INT32 ahead = (INT32)(blk - t.head) * t.dir;
+            if (t.valid && ahead >= 0 && ahead < (INT32)m_degree) s = &t;
+        }
+        if (!s)
+        {
+            s = &m_streams[0];
+            for (size_t i = 1; i < m_streams.size(); i++)
+                if (!m_streams[i].valid || (s->valid && m_streams[i].used < s->used)) s = &m_streams[i];
+            s->valid = true;
+            s->dir = m_last_miss == blk + 1 ? -1 : 1;
+            s->tail = blk;
+        }
+        s->head = blk + s->dir;
+        s->used = m_time;
+        m_last_miss = blk;
+
+        // Keep degree blocks ahead of the head prefetched
+        while ((INT32)(s->tail - s->head) * s->dir < (INT32)m_degree - 1)
+        {
+            s->tail += s->dir;
+            blocks.push_back(s->tail);
+        }
+    }
+
+private:
+    struct Stream
+    {
+        Stream() : valid(false), head(0), tail(0), dir(1), used(0) {}
+        bool valid;
+        UINT32 head;        // next block the stream expects
+        UINT32 tail;        // furthest block prefetched
+        INT32 dir;
+        UINT64 used;
+    };
+
+    std::vector<Stream> m_streams;
+    UINT32 m_last_miss;
+    UINT64 m_time;
+};
+
+// Prefetcher for the -pf knob, NULL for "none" or an unknown name
+Prefetcher* makePrefetcher(const std::string& kind, UINT32 degree)
+{
+    if (kind == "next") return new NextLinePrefetcher(degree);
+    if (kind == "stride") return new StridePrefetcher(degree);
+    if (kind == "stream") return new StreamPrefetcher(degree);
+    return NULL;
+}
+
+/**************************************
+ * Timing Model
+**************************************/
+class CacheModel;
+
+// Simulated time for the demand accesses of one cache. An access issues
+// every cycle: the trace carries no dependences, so loads never wait for
+// their data and only a full MSHR file stalls issue. A hit takes the hit
+// latency. A miss looks up the lower levels in order (the pintool adds an
+// L2 with -l2sets), takes the latency of the first that hits, or of memory,
+// and holds an MSHR for that long; further accesses to the block meanwhile
+// merge into it and wait for the rest of it. Prefetch fills are not timed.
+class TimingModel
+{
+public:
+    TimingModel(UINT32 hit_latency, UINT32 mem_latency, UINT32 mshrs)
+        : m_hit_latency(hit_latency), m_mem_latency(mem_latency), m_mshrs(mshrs ? mshrs : 1),
+          m_now(0), m_last_event(0), m_accesses(0), m_latency_sum(0), m_stall(0), m_full(0),
+          m_primary(0), m_merged(0), m_mlp_area(0), m_mlp_cycles(0) {}
+    ~TimingModel();     // defined after CacheModel
+
+    // Serve misses from level, with the given load-to-use latency, before
+    // the levels added after it and memory. The model owns the level.
+    void addLevel(CacheModel* level, UINT32 latency)
+    {
+        m_levels.push_back(level);
+        m_latencies.push_back(latency);
+        m_served.push_back(0);
+    }
+
+    // Called by the cache for every demand access to block blk
+    void access(UINT32 mem_addr, UINT32 blk, bool hit, bool write)
+    {
+        m_accesses++;
+        advance(++m_now);
+
+        std::map<UINT32, UINT64>::iterator it = m_outstanding.find(blk);
+        if (it != m_outstanding.end())
+        {
+            m_merged++;
+            m_latency_sum += it->second - m_now;
+            return;
+        }
+        if (hit)
+        {
+            m_latency_sum += m_hit_latency;
+            return;
+        }
+
+        UINT64 issue = m_now;
+        if (m_outstanding.size() >= m_mshrs)
+        {
+            m_full++;
+            m_now = firstReady();
+            m_stall += m_now - issue;
+            advance(m_now);
+        }
+        UINT64 ready = m_now + serve(mem_addr, write);
+        m_outstanding[blk] = ready;
+        m_primary++;
+        m_latency_sum += ready - issue;
+    }
+
+    // AMAT, stall cycles and the memory-level parallelism achieved: the
+    // average number of outstanding misses over the cycles with at least
+    // one (Chou, Fahs and Abraham)
+    void dumpResults()
+    {
+        UINT64 end = m_now;
+        for (std::map<UINT32, UINT64>::iterator it = m_outstanding.begin(); it != m_outstanding.end(); it++)
+            end = std::max(end, it->second);
+        advance(end);
+        printf("\tsimulated cycles: %lu,\tstall cycles: %lu,\tMSHRs full: %lu times\n", end, m_stall, m_full);
+        printf("\tAMAT: %.2f cycles,\tprimary misses: %lu,\tmerged misses: %lu,\tMLP: %.2f\n",
+               m_accesses ? (double)m_latency_sum / m_accesses : 0, m_primary, m_merged,
+               m_mlp_cycles ? m_mlp_area / m_mlp_cycles : 0);
+        UINT64 to_memory = m_primary;
+        for (size_t i = 0; i < m_levels.size(); i++)
+        {
+            printf("\tmisses served by L%u: %lu (%.2f%%, %u cycles)\n", (UINT32)i + 2, m_served[i],
+                   m_primary ? 100.0 * m_served[i] / m_primary : 0, m_latencies[i]);
+            to_memory -= m_served[i];
+        }
+        if (!m_levels.empty())
+            printf("\tmisses served by memory: %lu (%.2f%%, %u cycles)\n", to_memory,
+                   m_primary ? 100.0 * to_memory / m_primary : 0, m_mem_latency);
+    }
+
+private:
+    UINT32 m_hit_latency;
+    UINT32 m_mem_latency;
+    UINT32 m_mshrs;
+    std::vector<CacheModel*> m_levels;
+    std::vector<UINT32> m_latencies;
+    std::vector<UINT64> m_served;               // primary misses each level hit
+    std::map<UINT32, UINT64> m_outstanding;     // MSHRs: block -> cycle its data arrives
+
+    UINT64 m_now;           // issue cycle of the current access
+    UINT64 m_last_event;    // MLP is accounted up to here
+    UINT64 m_accesses;
+    UINT64 m_latency_sum;   // issue to data, including stalls
+    UINT64 m_stall;         // cycles issue waited for an MSHR
+    UINT64 m_full;
+    UINT64 m_primary;       // misses that allocated an MSHR
+    UINT64 m_merged;        // accesses to a block already in an MSHR
+    double m_mlp_area;      // sum over cycles of outstanding misses
+    UINT64 m_mlp_cycles;    // cycles with at least one outstanding miss
+
+    // Latency of the level that serves a miss; defined after CacheModel
+    UINT32 serve(UINT32 mem_addr, bool write);
+
+    UINT64 firstReady()
+    {
+        UINT64 first = m_outstanding.begin()->second;
+        for (std::map<UINT32, UINT64>::iterator it = m_outstanding.begin(); it != m_outstanding.end(); it++)
+            first = std::min(first, it->second);
+        return first;
+    }
+
+    // Retire the MSHRs whose data has arrived by cycle to, accounting the
+    // outstanding misses between events
+    void advance(UINT64 to)
+    {
+        while (!m_outstanding.empty())
+        {
+            UINT64 first = firstReady();
+            if (first > to) break;
+            account(first);
+            for (std::map<UINT32, UINT64>::iterator it = m_outstanding.begin(); it != m_outstanding.end(); )
+                if (it->second == first) m_outstanding.erase(it++);
+                else it++;
+        }
+        account(to);
+    }
+
+    void account(UINT64 to)
+    {
+        if (to <= m_last_event) return;
+        if (!m_outstanding.empty())
+        {
+            m_mlp_area += (double)m_outstanding.size() * (to - m_last_event);
+            m_mlp_cycles += to - m_last_event;
+        }
+        m_last_event = to;
+    }
+};
 
 /**************************************
  * Cache Model Base Class
 **************************************/
+#define PF_QUEUE 32     // outstanding prefetches per cache
+#define UTIL_BUCKETS 8  // utilization histogram buckets, each 1/8 of a block
+#define PT_SPACE 0x80000000u    // tag bit of page table lines; data tags never
+                                // reach it while blocks are at least 2 bytes
+
+enum MissKind { COMPULSORY, CAPACITY, CONFLICT, MISS_KINDS };
+
+// Geometry and request counters of a cache in a checkpoint, followed by its
+// tags and replacement queue (UINT32 each) and valid bits (one byte each,
+// padded to 8)
+struct CacheImage
+{
+    UINT32 block_num;
+    UINT32 blksz_log;
+    UINT32 ways;
+    UINT32 reserved;
+    UINT64 rd_reqs;
+    UINT64 wr_reqs;
+    UINT64 rd_hits;
+    UINT64 wr_hits;
+};
+
+// Demand accesses and classified misses of one PC or data region
+struct MissCount
+{
+    MissCount() : accesses(0) { misses[COMPULSORY] = misses[CAPACITY] = misses[CONFLICT] = 0; }
+    UINT64 total() const { return misses[COMPULSORY] + misses[CAPACITY] + misses[CONFLICT]; }
+
+    UINT64 accesses;
+    UINT64 misses[MISS_KINDS];
+};
+
 class CacheModel
 {
 public:
     // Constructor
     CacheModel(UINT32 block_num, UINT32 log_block_size)
         : m_block_num(block_num), m_blksz_log(log_block_size),
-          m_rd_reqs(0), m_wr_reqs(0), m_rd_hits(0), m_wr_hits(0)
+          m_rd_reqs(0), m_wr_reqs(0), m_rd_hits(0), m_wr_hits(0),
+          m_prefetcher(NULL), m_shadow(NULL), m_pf_delay(0), m_now(0),
+          m_pf_issued(0), m_pf_useful(0), m_pf_late(0), m_pf_pollution(0),
+          m_fa_shadow(NULL), m_region_log(12), m_top(0), m_timing(NULL),
+          m_lines(NULL), m_cur_line(0), m_util_lines(0), m_util_bytes(0),
+          m_space(0), m_pte_reqs(0), m_pte_hits(0)
     {
+        m_misses[COMPULSORY] = m_misses[CAPACITY] = m_misses[CONFLICT] = 0;
+        for (int i = 0; i < UTIL_BUCKETS; i++) m_util_hist[i] = 0;
         m_valids = new bool[m_block_num];
         m_tags = new UINT32[m_block_num];
         m_replace_q = new UINT32[m_block_num];
@@ -31,24 +413,144 @@ public:
         delete[] m_valids;
         delete[] m_tags;
         delete[] m_replace_q;
+        delete m_prefetcher;
+        delete m_shadow;
+        delete m_fa_shadow;
+        delete m_timing;
+        delete[] m_lines;
+    }
+
+    // An empty cache of the same geometry
+    virtual CacheModel* clone() = 0;
+
+    // Blocks per set
+    virtual UINT32 ways() = 0;
+
+    // Save the tags, valid bits, replacement queue and request counters to a
+    // checkpoint, or restore them from one. A restored image of another
+    // geometry fails the checkpoint, and its counters are only taken with
+    // keep_stats. Add-ons (prefetcher, timing, miss and line statistics)
+    // are not saved and start cold.
+    void transfer(CheckpointState& state, bool keep_stats)
+    {
+        CacheImage image = { m_block_num, m_blksz_log, ways(), 0, m_rd_reqs, m_wr_reqs, m_rd_hits, m_wr_hits };
+        state.transfer(&image, sizeof(image));
+        if (image.block_num != m_block_num || image.blksz_log != m_blksz_log || image.ways != ways())
+            state.ok = FALSE;
+        std::vector<UINT8> valids((m_block_num + 7) / 8 * 8, 0);
+        for (UINT32 i = 0; i < m_block_num; i++)
+            valids[i] = m_valids[i];
+        state.transfer(m_tags, sizeof(UINT32) * m_block_num);
+        state.transfer(m_replace_q, sizeof(UINT32) * m_block_num);
+        state.transfer(&valids[0], valids.size());
+        if (!state.ok || state.saving()) return;
+
+        for (UINT32 i = 0; i < m_block_num; i++)
+            m_valids[i] = valids[i] != 0;
+        if (keep_stats)
+        {
+            m_rd_reqs = image.rd_reqs;
+            m_wr_reqs = image.wr_reqs;
+            m_rd_hits = image.rd_hits;
+            m_wr_hits = image.wr_hits;
+        }
+    }
+
+    // Attach a prefetcher, which the cache then owns. A prefetch is filled
+    // delay demand accesses after it is issued, standing in for the memory
+    // latency; a demand miss to a block still on its way is a late prefetch.
+    // A copy of the cache without the prefetcher runs alongside, so demand
+    // misses that it would have hit are counted as pollution.
+    void attachPrefetcher(Prefetcher* prefetcher, UINT32 delay)
+    {
+        delete m_prefetcher;
+        delete m_shadow;
+        m_prefetcher = prefetcher;
+        m_prefetcher->setBlockSizeLog(m_blksz_log);
+        m_shadow = clone();
+        m_pf_delay = delay;
+    }
+
+    // Classify every demand miss as compulsory (first touch of the block),
+    // capacity (a fully associative LRU cache of the same size misses too)
+    // or conflict, and attribute it to the PC and to the 2^region_log byte
+    // data region that caused it; dumpResults lists the top PCs and regions
+    void enableMissStats(UINT32 region_log, UINT32 top);
+
+    // Time the demand accesses with timing, which the cache then owns
+    void attachTiming(TimingModel* timing)
+    {
+        delete m_timing;
+        m_timing = timing;
+    }
+
+    // Record which bytes of each resident block the demand accesses touch
+    // (see touchBytes). When a block is replaced, or the run ends, its
+    // touched bytes go into the utilization histogram. Blocks of up to 64
+    // bytes only, one bit per byte.
+    void enableLineStats()
+    {
+        delete[] m_lines;
+        m_lines = new LineUse[m_block_num + 1];
     }
 
-    // Update the cache state whenever data is read
-    void readReq(UINT32 mem_addr)
+    // Update the cache state whenever data is read by the instruction at pc,
+    // return whether it hit
+    bool readReq(UINT32 mem_addr, UINT32 pc = 0)
     {
         m_rd_reqs++;
-        if (access(mem_addr)) m_rd_hits++;
+        if (!demandAccess(mem_addr, pc, false)) return false;
+        m_rd_hits++;
+        return true;
     }
 
-    // Update the cache state whenever data is written
-    void writeReq(UINT32 mem_addr)
+    // Update the cache state whenever data is written by the instruction at
+    // pc, return whether it hit
+    bool writeReq(UINT32 mem_addr, UINT32 pc = 0)
     {
         m_wr_reqs++;
-        if (access(mem_addr)) m_wr_hits++;
+        if (!demandAccess(mem_addr, pc, true)) return false;
+        m_wr_hits++;
+        return true;
+    }
+
+    // Read a page table entry for a page walk. The line is filled like a
+    // read, but tagged with PT_SPACE so it cannot alias a data block, and
+    // counted apart from the demand requests: the prefetcher, miss, line
+    // and timing statistics never see it. The shadow caches take the fill
+    // too, so the space it occupies is not blamed on prefetches or conflicts.
+    bool walkRead(UINT32 pte_addr)
+    {
+        m_space = PT_SPACE;
+        bool hit = access(pte_addr);
+        m_space = 0;
+        if (m_shadow) m_shadow->walkRead(pte_addr);
+        if (m_fa_shadow) m_fa_shadow->walkRead(pte_addr);
+        m_pte_reqs++;
+        if (hit) m_pte_hits++;
+        return hit;
+    }
+
+    // Mark size bytes at addr as used by the demand access just made to
+    // addr; bytes past the end of the block are not counted
+    void touchBytes(UINT32 addr, UINT32 size)
+    {
+        if (!m_lines) return;
+        LineUse& line = m_lines[m_cur_line];
+        if (line.block != addr >> m_blksz_log) return;
+        UINT32 offset = addr & ((1 << m_blksz_log) - 1);
+        UINT32 end = std::min(offset + size, 1u << m_blksz_log);
+        if (end <= offset) return;
+        UINT64 bits = end - offset == 64 ? ~0ULL : ((1ULL << (end - offset)) - 1);
+        line.touched |= bits << offset;
     }
 
-    UINT32 getRdReq() { return m_rd_reqs; }
-    UINT32 getWrReq() { return m_wr_reqs; }
+    UINT64 getRdReq() { return m_rd_reqs; }
+    UINT64 getWrReq() { return m_wr_reqs; }
+    UINT64 getRdHit() { return m_rd_hits; }
+    UINT64 getWrHit() { return m_wr_hits; }
+    UINT64 getPteReq() { return m_pte_reqs; }
+    UINT64 getPteHit() { return m_pte_hits; }
 
     void dumpResults()
     {
@@ -56,6 +558,60 @@ public:
         float wrHitRate = 100 * (float)m_wr_hits/m_wr_reqs;
         printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_rd_reqs, m_rd_hits, rdHitRate);
         printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_wr_reqs, m_wr_hits, wrHitRate);
+        if (m_pte_reqs)
+            printf("\tpage table req: %lu,\thit: %lu,\thit rate: %.2f%%\n", m_pte_reqs, m_pte_hits,
+                   100 * (float)m_pte_hits / m_pte_reqs);
+        if (!m_prefetcher) return;
+
+        // accuracy: issued prefetches that demand used, late or not
+        // coverage: demand misses removed, of those there would have been
+        // timeliness: used prefetches that arrived before the demand
+        UINT64 misses = m_rd_reqs + m_wr_reqs - m_rd_hits - m_wr_hits;
+        UINT64 used = m_pf_useful + m_pf_late;
+        printf("\tprefetch (%s, delay %u): issued: %lu,\tuseful: %lu,\tlate: %lu,\tpollution: %lu\n",
+               m_prefetcher->name(), m_pf_delay, m_pf_issued, m_pf_useful, m_pf_late, m_pf_pollution);
+        printf("\taccuracy: %.2f%%,\tcoverage: %.2f%%,\ttimeliness: %.2f%%\n",
+               m_pf_issued ? 100 * (float)used / m_pf_issued : 0,
+               m_pf_useful + misses ? 100 * (float)m_pf_useful / (m_pf_useful + misses) : 0,
+               used ? 100 * (float)m_pf_useful / used : 0);
+    }
+
+    void dumpTiming()
+    {
+        if (m_timing) m_timing->dumpResults();
+    }
+
+    // Bytes used per demanded block over its stay in the cache
+    void dumpUtilization()
+    {
+        if (!m_lines) return;
+        for (UINT32 i = 0; i <= m_block_num; i++)
+            retireLine(m_lines[i]);
+
+        UINT32 blksz = 1 << m_blksz_log;
+        UINT32 step = std::max(blksz / UTIL_BUCKETS, 1u);
+        printf("\tline utilization: %.2f of %u bytes (%.2f%%) over %lu blocks fetched\n",
+               m_util_lines ? (float)m_util_bytes / m_util_lines : 0, blksz,
+               m_util_lines ? 100 * (float)m_util_bytes / (m_util_lines * blksz) : 0, m_util_lines);
+        printf("\tbytes used per block (bytes, blocks, share):\n");
+        for (UINT32 i = 0; i < UTIL_BUCKETS && i * step < blksz; i++)
+            printf("\t\t%u-%u, %lu, %.2f%%\n", i * step + 1, std::min((i + 1) * step, blksz), m_util_hist[i],
+                   m_util_lines ? 100 * (float)m_util_hist[i] / m_util_lines : 0);
+    }
+
+    // 3C split of the demand misses, then the PCs and data regions with the
+    // most misses
+    void dumpMissStats()
+    {
+        if (!m_fa_shadow) return;
+        UINT64 misses = m_misses[COMPULSORY] + m_misses[CAPACITY] + m_misses[CONFLICT];
+        if (misses == 0) misses = 1;
+        printf("\tcompulsory: %lu (%.2f%%),\tcapacity: %lu (%.2f%%),\tconflict: %lu (%.2f%%)\n",
+               m_misses[COMPULSORY], 100 * (float)m_misses[COMPULSORY] / misses,
+               m_misses[CAPACITY], 100 * (float)m_misses[CAPACITY] / misses,
+               m_misses[CONFLICT], 100 * (float)m_misses[CONFLICT] / misses);
+        printTop("PC", m_pc_misses, misses, 0);
+        printTop("region", m_region_misses, misses, m_region_log);
     }
 
 protected:
@@ -71,6 +627,46 @@ protected:
     UINT64 m_rd_hits;       // The number of hit read-requests
     UINT64 m_wr_hits;       // The number of hit write-requests
 
+    Prefetcher* m_prefetcher;
+    CacheModel* m_shadow;           // the same cache without prefetching
+    UINT32 m_pf_delay;              // demand accesses from issue to fill
+    UINT64 m_now;                   // demand accesses so far
+    std::deque<std::pair<UINT64, UINT32> > m_pf_queue;     // (fill time, block) in flight
+    std::set<UINT32> m_pf_blocks;   // prefetched blocks not yet demanded
+
+    UINT64 m_pf_issued;     // prefetches sent to memory
+    UINT64 m_pf_useful;     // prefetched blocks hit by a later demand
+    UINT64 m_pf_late;       // demand misses to blocks still in flight
+    UINT64 m_pf_pollution;  // demand misses the cache without prefetching hits
+
+    CacheModel* m_fa_shadow;        // fully associative cache of the same size
+    std::set<UINT32> m_seen_blocks; // blocks demanded so far
+    UINT32 m_region_log;
+    UINT32 m_top;                   // PCs and regions to report
+    UINT64 m_misses[MISS_KINDS];
+    std::map<UINT32, MissCount> m_pc_misses;
+    std::map<UINT32, MissCount> m_region_misses;    // by address >> m_region_log
+
+    TimingModel* m_timing;
+
+    // The demanded block in a cache block frame and its touched bytes
+    struct LineUse
+    {
+        LineUse() : valid(false), block(0), touched(0) {}
+        bool valid;
+        UINT32 block;
+        UINT64 touched;
+    };
+    LineUse* m_lines;               // by block id, plus a spare at m_block_num
+    UINT32 m_cur_line;              // block id of the last demand access
+    UINT64 m_util_lines;            // blocks retired
+    UINT64 m_util_bytes;            // bytes they used
+    UINT64 m_util_hist[UTIL_BUCKETS];
+
+    UINT32 m_space;                 // ORed into tags: 0, or PT_SPACE in walkRead
+    UINT64 m_pte_reqs;              // page table entry reads
+    UINT64 m_pte_hits;
+
     // Look up the cache to decide whether the access is hit or missed
     virtual bool lookup(UINT32 mem_addr, UINT32& blk_id) = 0;
 
@@ -79,6 +675,166 @@ protected:
 
     // Update m_replace_q
     virtual void updateReplaceQ(UINT32 blk_id) = 0;
+
+private:
+    bool demandAccess(UINT32 mem_addr, UINT32 pc, bool write)
+    {
+        bool hit = m_prefetcher ? prefetchedAccess(mem_addr, pc) : access(mem_addr);
+        if (m_fa_shadow) classifyMiss(mem_addr, pc, hit);
+        if (m_lines) trackLine(mem_addr, hit);
+        if (m_timing) m_timing->access(mem_addr, mem_addr >> m_blksz_log, hit, write);
+        return hit;
+    }
+
+    // A miss brings in a new block; a hit on a block other than the one
+    // recorded was prefetched into the frame. Either way the frame's
+    // previous block has left the cache.
+    //
+    // A prefetch filled with no delay can evict the demanded block before
+    // this runs. A block that hit keeps its frame's record, which retires
+    // when the frame is next used; a block that missed never had a frame,
+    // so it is recorded in the spare slot and retired on the next access.
+    void trackLine(UINT32 mem_addr, bool hit)
+    {
+        UINT32 blk = mem_addr >> m_blksz_log;
+        retireLine(m_lines[m_block_num]);
+        if (!lookup(mem_addr, m_cur_line))
+        {
+            m_cur_line = m_block_num;
+            for (UINT32 i = 0; hit && i < m_block_num; i++)
+                if (m_lines[i].valid && m_lines[i].block == blk) m_cur_line = i;
+            if (m_cur_line == m_block_num)
+            {
+                m_lines[m_cur_line].valid = true;
+                m_lines[m_cur_line].block = blk;
+            }
+            return;
+        }
+        LineUse& line = m_lines[m_cur_line];
+        if (hit && line.valid && line.block == blk) return;
+        retireLine(line);
+        line.valid = true;
+        line.block = blk;
+    }
+
+    void retireLine(LineUse& line)
+    {
+        if (!line.valid) return;
+        UINT32 used = __builtin_popcountll(line.touched);
+        UINT32 step = std::max((1u << m_blksz_log) / UTIL_BUCKETS, 1u);
+        m_util_hist[std::min(used ? (used - 1) / step : 0, (UINT32)UTIL_BUCKETS - 1)]++;
+        m_util_lines++;
+        m_util_bytes += used;
+        line.valid = false;
+        line.touched = 0;
+    }
+
+    void classifyMiss(UINT32 mem_addr, UINT32 pc, bool hit)
+    {
+        bool fa_hit = m_fa_shadow->access(mem_addr);
+        bool seen = !m_seen_blocks.insert(mem_addr >> m_blksz_log).second;
+        MissCount& by_pc = m_pc_misses[pc];
+        MissCount& by_region = m_region_misses[mem_addr >> m_region_log];
+        by_pc.accesses++;
+        by_region.accesses++;
+        if (hit) return;
+
+        MissKind kind = !seen ? COMPULSORY : fa_hit ? CONFLICT : CAPACITY;
+        m_misses[kind]++;
+        by_pc.misses[kind]++;
+        by_region.misses[kind]++;
+    }
+
+    static bool moreMisses(const std::pair<UINT32, MissCount>& a, const std::pair<UINT32, MissCount>& b)
+    {
+        return a.second.total() > b.second.total();
+    }
+
+    // The m_top keys with the most misses; a key is a PC, or a region
+    // number when region_log is set
+    void printTop(const char* what, const std::map<UINT32, MissCount>& counts, UINT64 misses, UINT32 region_log)
+    {
+        std::vector<std::pair<UINT32, MissCount> > top(counts.begin(), counts.end());
+        std::sort(top.begin(), top.end(), moreMisses);
+        if (top.size() > m_top) top.resize(m_top);
+        printf("\ttop %u %ss by misses (%s, misses, share, miss rate, compulsory, capacity, conflict):\n",
+               (UINT32)top.size(), what, what);
+        for (size_t i = 0; i < top.size() && top[i].second.total(); i++)
+        {
+            MissCount& c = top[i].second;
+            if (region_log)
+                printf("\t\t0x%08x-0x%08x", top[i].first << region_log, ((top[i].first + 1) << region_log) - 1);
+            else
+                printf("\t\t0x%08x", top[i].first);
+            printf(", %lu, %.2f%%, %.2f%%, %lu, %lu, %lu\n", c.total(), 100 * (float)c.total() / misses,
+                   100 * (float)c.total() / c.accesses, c.misses[COMPULSORY], c.misses[CAPACITY], c.misses[CONFLICT]);
+        }
+    }
+
+    // A demand access: fill the prefetches that have arrived, access the
+    // cache, account for the prefetches, then train the prefetcher and
+    // issue what it asks for
+    bool prefetchedAccess(UINT32 mem_addr, UINT32 pc)
+    {
+        m_now++;
+        while (!m_pf_queue.empty() && m_pf_queue.front().first <= m_now)
+        {
+            fillPrefetch(m_pf_queue.front().second);
+            m_pf_queue.pop_front();
+        }
+
+        UINT32 blk = mem_addr >> m_blksz_log;
+        bool hit = access(mem_addr);
+        bool shadow_hit = m_shadow->access(mem_addr);
+        bool first_use = m_pf_blocks.erase(blk) && hit;
+        if (first_use)
+            m_pf_useful++;
+        if (!hit)
+        {
+            std::deque<std::pair<UINT64, UINT32> >::iterator it = m_pf_queue.begin();
+            while (it != m_pf_queue.end() && it->second != blk) it++;
+            if (it != m_pf_queue.end())
+            {
+                m_pf_late++;
+                m_pf_queue.erase(it);
+            }
+            else if (shadow_hit)
+                m_pf_pollution++;
+        }
+
+        std::vector<UINT32> blocks;
+        m_prefetcher->train(pc, mem_addr, !hit || first_use, blocks);
+        for (size_t i = 0; i < blocks.size(); i++)
+            issuePrefetch(blk, blocks[i]);
+        return hit;
+    }
+
+    // Send a prefetch for blk to memory unless it leaves the 4KB page of
+    // the demand block, is cached, is already in flight or the queue of
+    // PF_QUEUE outstanding prefetches is full
+    void issuePrefetch(UINT32 demand_blk, UINT32 blk)
+    {
+        UINT32 page_log = 12 > m_blksz_log ? 12 - m_blksz_log : 0;
+        UINT32 blk_id;
+        if ((blk >> page_log) != (demand_blk >> page_log)) return;
+        if (lookup(blk << m_blksz_log, blk_id) || m_pf_queue.size() >= PF_QUEUE) return;
+        for (size_t i = 0; i < m_pf_queue.size(); i++)
+            if (m_pf_queue[i].second == blk) return;
+
+        m_pf_issued++;
+        if (m_pf_delay == 0)
+            fillPrefetch(blk);
+        else
+            m_pf_queue.push_back(std::make_pair(m_now + m_pf_delay, blk));
+    }
+
+    void fillPrefetch(UINT32 blk)
+    {
+        UINT32 blk_id;
+        if (lookup(blk << m_blksz_log, blk_id)) return;
+        access(blk << m_blksz_log);
+        m_pf_blocks.insert(blk);
+    }
 };
 
 /**************************************
@@ -94,8 +850,11 @@ public:
     // Destructor
     ~FullAssoCache() {}
 
+    CacheModel* clone() { return new FullAssoCache(m_block_num, m_blksz_log); }
+    UINT32 ways() { return m_block_num; }
+
 private:
-    UINT32 getTag(UINT32 addr) { return addr >> m_blksz_log;/* TODO */ }
+    UINT32 getTag(UINT32 addr) { return (addr >> m_blksz_log) | m_space;/* TODO */ }
 
     // Look up the cache to decide whether the access is hit or missed
     bool lookup(UINT32 mem_addr, UINT32& blk_id)
@@ -154,6 +913,31 @@ private:
     }
 };
 
+TimingModel::~TimingModel()
+{
+    for (size_t i = 0; i < m_levels.size(); i++)
+        delete m_levels[i];
+}
+
+UINT32 TimingModel::serve(UINT32 mem_addr, bool write)
+{
+    for (size_t i = 0; i < m_levels.size(); i++)
+        if (write ? m_levels[i]->writeReq(mem_addr) : m_levels[i]->readReq(mem_addr))
+        {
+            m_served[i]++;
+            return m_latencies[i];
+        }
+    return m_mem_latency;
+}
+
+void CacheModel::enableMissStats(UINT32 region_log, UINT32 top)
+{
+    delete m_fa_shadow;
+    m_fa_shadow = new FullAssoCache(m_block_num, m_blksz_log);
+    m_region_log = region_log;
+    m_top = top;
+}
+
 /**************************************
  * Directly Mapped Cache Class
 **************************************/
@@ -167,10 +951,13 @@ public:
     // Destructor
     ~DirectMapCache() {}
 
+    CacheModel* clone() { return new DirectMapCache(m_block_num, m_blksz_log); }
+    UINT32 ways() { return 1; }
+
 private:
 
     // 
-	UINT32 getTag(UINT32 addr) { return addr >> (m_blksz_log + UINT32(log2(m_block_num)));/* TODO */ }
+	UINT32 getTag(UINT32 addr) { return (addr >> (m_blksz_log + UINT32(log2(m_block_num)))) | m_space;/* TODO */ }
 	UINT32 getBlk_num(UINT32 addr) { return (addr >> m_blksz_log) & (m_block_num-1);/* TODO */ }
     // Look up the cache to decide whether the access is hit or missed
     bool lookup(UINT32 mem_addr, UINT32& blk_id)
@@ -229,10 +1016,13 @@ public:
     // Destructor
     ~SetAssoCache() {}
 
+    CacheModel* clone() { return new SetAssoCache(m_sets_log, m_blksz_log, m_ass); }
+    UINT32 ways() { return m_ass; }
+
 private:
 
     // 
-	UINT32 getTag(UINT32 addr) { return addr >> (m_blksz_log + m_sets_log);/* TODO */ }
+	UINT32 getTag(UINT32 addr) { return (addr >> (m_blksz_log + m_sets_log)) | m_space;/* TODO */ }
 	UINT32 getSet_num(UINT32 addr) { return (addr >> m_blksz_log) & ((1<<m_sets_log)-1);/* TODO */ }
     // Look up the cache to decide whether the access is hit or missed
     bool lookup(UINT32 mem_addr, UINT32& blk_id)
@@ -288,54 +1078,844 @@ private:
     }
 };
 
-CacheModel* my_fa_cache;
-CacheModel* my_dm_cache;
-CacheModel* my_sa_cache;
-
-double time_fa_rd = 0, time_fa_wr = 0;
-double time_dm_rd = 0, time_dm_wr = 0;
-double time_sa_rd = 0, time_sa_wr = 0;
+/**************************************
+ * Set-Partitioned Parallel Set-Associative Cache
+**************************************/
+#define SPSC_SIZE (1 << 16)     // entries per worker queue, a power of 2
+#define SPSC_BATCH 256          // entries the producer publishes at once
+#define SPSC_SPINS 1024         // empty polls a consumer yields through before it sleeps
 
-// Cache reading analysis routine
-void readCache(UINT32 mem_addr)
+// Single-producer single-consumer ring of accesses. The producer fills
+// slots ahead of the published tail and publishes SPSC_BATCH of them with
+// one release store, so the two threads share a cache line once per batch
+// rather than once per access. Pushes must be serialized by the caller:
+// readCache and writeCache push under cache_lock, so the application
+// threads take turns as the one producer. An idle consumer yields, then
+// sleeps a millisecond at a time, rather than spinning on a CPU.
+class SpscQueue
 {
-    mem_addr = (mem_addr >> 2) << 2;
-    clock_t pt0 = clock();
-    my_fa_cache->readReq(mem_addr);
-    clock_t pt1 = clock();
-    my_dm_cache->readReq(mem_addr);
-    clock_t pt2 = clock();
-    my_sa_cache->readReq(mem_addr);
-    clock_t pt3 = clock();
+public:
+    SpscQueue() : m_head(0), m_tail(0), m_local_tail(0), m_cached_head(0), m_done(false), m_idle(0)
+    {
+        m_buf = new UINT64[SPSC_SIZE];
+    }
 
-    time_fa_rd += 1000000*(double)(pt1 - pt0) / CLOCKS_PER_SEC;
-    time_dm_rd += 1000000*(double)(pt2 - pt1) / CLOCKS_PER_SEC;
-    time_sa_rd += 1000000*(double)(pt3 - pt2) / CLOCKS_PER_SEC;
-}
+    ~SpscQueue() { delete[] m_buf; }
 
-// Cache writing analysis routine
-void writeCache(UINT32 mem_addr)
-{
-    mem_addr = (mem_addr >> 2) << 2;
-    clock_t pt0 = clock();
-    my_fa_cache->writeReq(mem_addr);
-    clock_t pt1 = clock();
-    my_dm_cache->writeReq(mem_addr);
-    clock_t pt2 = clock();
-    my_sa_cache->writeReq(mem_addr);
-    clock_t pt3 = clock();
+    // Producer side
+    void push(UINT64 entry)
+    {
+        while (m_local_tail - m_cached_head >= SPSC_SIZE)
+        {
+            publish();
+            m_cached_head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+            if (m_local_tail - m_cached_head >= SPSC_SIZE) PIN_Yield();
+        }
+        m_buf[m_local_tail & (SPSC_SIZE - 1)] = entry;
+        if (++m_local_tail % SPSC_BATCH == 0) publish();
+    }
 
-    time_fa_wr += 1000000*(double)(pt1 - pt0) / CLOCKS_PER_SEC;
-    time_dm_wr += 1000000*(double)(pt2 - pt1) / CLOCKS_PER_SEC;
-    time_sa_wr += 1000000*(double)(pt3 - pt2) / CLOCKS_PER_SEC;
-}
+    void publish() { __atomic_store_n(&m_tail, m_local_tail, __ATOMIC_RELEASE); }
 
-// This knob will set the cache param m_block_num
-KNOB<UINT32> KnobBlockNum(KNOB_MODE_WRITEONCE, "pintool",
-        "n", "512", "specify the number of blocks in bytes");
+    void close()
+    {
+        publish();
+        __atomic_store_n(&m_done, true, __ATOMIC_RELEASE);
+    }
 
-// This knob will set the cache param m_blksz_log
-KNOB<UINT32> KnobBlockSizeLog(KNOB_MODE_WRITEONCE, "pintool",
+    // Consumer side: hand every published entry to consume, return false
+    // once the queue is closed and drained
+    template <typename F>
+    bool drain(F& consume)
+    {
+        bool done = __atomic_load_n(&m_done, __ATOMIC_ACQUIRE);
+        UINT64 tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        if (tail == m_head)
+        {
+            if (done) return false;
+            if (++m_idle < SPSC_SPINS) PIN_Yield();
+            else PIN_Sleep(1);
+            return true;
+        }
+        m_idle = 0;
+        for (UINT64 i = m_head; i < tail; i++)
+            consume(m_buf[i & (SPSC_SIZE - 1)]);
+        __atomic_store_n(&m_head, tail, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    UINT64* m_buf;
+    // consumer and producer indices on their own cache lines
+    char m_pad0[64];
+    UINT64 m_head;
+    char m_pad1[64];
+    UINT64 m_tail;
+    char m_pad2[64];
+    UINT64 m_local_tail;    // producer only
+    UINT64 m_cached_head;   // producer only
+    bool m_done;
+    UINT32 m_idle;          // consumer only: empty polls in a row
+};
+
+// A cache model simulated on its own Pin internal thread. An entry holds
+// the 32 address bits the caches see, the access size and a write bit; the
+// worker replays it as readReq or writeReq plus touchBytes, so line
+// statistics work as they do inline. The cache stays owned by the caller.
+class CacheWorker
+{
+public:
+    CacheWorker(CacheModel* cache) : m_cache(cache) {}
+
+    CacheModel* cache() { return m_cache; }
+
+    bool start()
+    {
+        return PIN_SpawnInternalThread(workerMain, this, 0, &m_uid) != INVALID_THREADID;
+    }
+
+    // Producer side, under cache_lock
+    void push(UINT32 addr, UINT32 size, bool write)
+    {
+        m_queue.push((UINT64)addr | (UINT64)std::min(size, 0xffffu) << 32 | (UINT64)write << 48);
+    }
+
+    // Stop taking entries; join() then waits until the rest are simulated
+    void close() { m_queue.close(); }
+    void join() { PIN_WaitForThreadTermination(m_uid, PIN_INFINITE_TIMEOUT, NULL); }
+
+    void operator()(UINT64 entry)
+    {
+        UINT32 addr = (UINT32)entry;
+        UINT32 mem_addr = (addr >> 2) << 2;
+        if (entry >> 48) m_cache->writeReq(mem_addr);
+        else m_cache->readReq(mem_addr);
+        m_cache->touchBytes(addr, (UINT32)(entry >> 32) & 0xffff);
+    }
+
+private:
+    CacheModel* m_cache;
+    SpscQueue m_queue;
+    PIN_THREAD_UID m_uid;
+
+    static VOID workerMain(VOID* arg)
+    {
+        CacheWorker* w = (CacheWorker*)arg;
+        while (w->m_queue.drain(*w)) ;
+    }
+};
+
+// A SetAssoCache split by set index over 2^workers_log CacheWorkers.
+// Worker w owns the sets whose low index bits are w and simulates them in
+// its own SetAssoCache with the worker bits removed from the address, so
+// every set still sees its accesses in program order and the hit counts
+// equal those of a single SetAssoCache exactly. Prefetchers, miss
+// classification, timing and sampling need the serial model.
+class ParallelSetAssoCache
+{
+public:
+    ParallelSetAssoCache(UINT32 sets_log, UINT32 log_blk_size, UINT32 ass, UINT32 workers_log)
+        : m_sets_log(sets_log), m_blksz_log(log_blk_size), m_workers_log(std::min(workers_log, sets_log))
+    {
+        for (UINT32 i = 0; i < (1u << m_workers_log); i++)
+            m_workers.push_back(new CacheWorker(new SetAssoCache(m_sets_log - m_workers_log, m_blksz_log, ass)));
+    }
+
+    ~ParallelSetAssoCache()
+    {
+        for (size_t i = 0; i < m_workers.size(); i++)
+        {
+            delete m_workers[i]->cache();
+            delete m_workers[i];
+        }
+    }
+
+    // Spawn the workers; call from main before PIN_StartProgram
+    bool start()
+    {
+        for (size_t i = 0; i < m_workers.size(); i++)
+            if (!m_workers[i]->start()) return false;
+        return true;
+    }
+
+    // Close the queues and wait until every worker has drained its queue
+    void finish()
+    {
+        for (size_t i = 0; i < m_workers.size(); i++)
+            m_workers[i]->close();
+        for (size_t i = 0; i < m_workers.size(); i++)
+            m_workers[i]->join();
+    }
+
+    // addr and size as for touchBytes; under cache_lock
+    void readReq(UINT32 addr, UINT32 size) { route(addr, size, false); }
+    void writeReq(UINT32 addr, UINT32 size) { route(addr, size, true); }
+
+    // Totals over the workers, valid after finish()
+    UINT64 getRdReq() { return sum(&CacheModel::getRdReq); }
+    UINT64 getWrReq() { return sum(&CacheModel::getWrReq); }
+    UINT64 getRdHit() { return sum(&CacheModel::getRdHit); }
+    UINT64 getWrHit() { return sum(&CacheModel::getWrHit); }
+
+    UINT32 workers() { return m_workers.size(); }
+
+    void dumpResults()
+    {
+        float rdHitRate = 100 * (float)getRdHit()/getRdReq();
+        float wrHitRate = 100 * (float)getWrHit()/getWrReq();
+        printf("\tread req: %lu,\thit: %lu,\thit rate: %.2f%%\n", getRdReq(), getRdHit(), rdHitRate);
+        printf("\twrite req: %lu,\thit: %lu,\thit rate: %.2f%%\n", getWrReq(), getWrHit(), wrHitRate);
+    }
+
+private:
+    UINT32 m_sets_log;
+    UINT32 m_blksz_log;
+    UINT32 m_workers_log;
+    std::vector<CacheWorker*> m_workers;
+
+    // The worker sees the address with the worker bits of the block number
+    // removed and the offset in the block kept
+    void route(UINT32 addr, UINT32 size, bool write)
+    {
+        UINT32 blk = addr >> m_blksz_log;
+        UINT32 local = (blk >> m_workers_log) << m_blksz_log | (addr & ((1u << m_blksz_log) - 1));
+        m_workers[blk & ((1u << m_workers_log) - 1)]->push(local, size, write);
+    }
+
+    UINT64 sum(UINT64 (CacheModel::*get)())
+    {
+        UINT64 total = 0;
+        for (size_t i = 0; i < m_workers.size(); i++)
+            total += (m_workers[i]->cache()->*get)();
+        return total;
+    }
+};
+
+/**************************************
+ * Validation against cache_test
+**************************************/
+// One cache level of the topology file written by cache_test (lab 4)
+struct TopoLevel
+{
+    UINT32 size;        // capacity in bytes
+    UINT32 line;        // line size in bytes
+    UINT32 ways;
+    double latency;     // measured hit latency in ns
+};
+
+// One point of the cache_test size sweep
+struct SweepPoint
+{
+    UINT32 footprint;
+    double latency;     // measured ns/load
+    double misses[2];   // measured L1D / last-level misses per load, -1 if unknown
+};
+
+// Number after the first "key": in text[from, end), or fallback if there
+// is none or it is null. cache_test writes the file, so this does not need
+// to be a general JSON parser.
+double jsonNumber(const std::string& text, const std::string& key, size_t from, size_t end, double fallback)
+{
+    size_t pos = text.find("\"" + key + "\":", from);
+    if (pos == std::string::npos || pos >= end) return fallback;
+    pos = text.find_first_not_of(' ', pos + key.size() + 3);
+    if (pos == std::string::npos || text.compare(pos, 4, "null") == 0) return fallback;
+    return atof(text.c_str() + pos);
+}
+
+// [begin, end) of the array value of "key"
+bool jsonArray(const std::string& text, const std::string& key, size_t& begin, size_t& end)
+{
+    begin = text.find("\"" + key + "\":");
+    if (begin == std::string::npos) return false;
+    begin = text.find('[', begin);
+    int depth = 0;
+    for (end = begin; end < text.size(); end++)
+    {
+        if (text[end] == '[') depth++;
+        if (text[end] == ']' && --depth == 0) return true;
+    }
+    return false;
+}
+
+// Read the measured levels, the memory latency and the size sweep. Line
+// size and ways that cache_test did not measure are taken from the sysfs
+// description next to them, else 64B and 16 ways.
+bool readTopology(const std::string& path, std::vector<TopoLevel>& levels,
+                  double& mem_latency, std::vector<SweepPoint>& sweep)
+{
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+
+    size_t begin, end;
+    if (!jsonArray(text, "levels", begin, end)) return false;
+    for (size_t pos = text.find("\"level\":", begin); pos < end; )
+    {
+        size_t next = std::min(text.find("\"level\":", pos + 1), end);
+        size_t sysfs = std::min(text.find("\"sysfs\":", pos), next);
+        TopoLevel level;
+        level.size = (UINT32)jsonNumber(text, "size", pos, next, 0);
+        level.line = (UINT32)jsonNumber(text, "line_size", pos, sysfs, 0);
+        if (level.line == 0) level.line = (UINT32)jsonNumber(text, "line_size", sysfs, next, 64);
+        level.ways = (UINT32)jsonNumber(text, "ways", pos, sysfs, 0);
+        if (level.ways == 0) level.ways = (UINT32)jsonNumber(text, "ways", sysfs, next, 16);
+        level.latency = jsonNumber(text, "latency_ns", pos, next, 0);
+        if (level.size > 0) levels.push_back(level);
+        pos = next;
+    }
+    mem_latency = jsonNumber(text, "memory_latency_ns", 0, text.size(), 0);
+
+    if (!jsonArray(text, "size_sweep", begin, end)) return false;
+    for (size_t pos = text.find("\"footprint\":", begin); pos < end; )
+    {
+        size_t next = std::min(text.find("\"footprint\":", pos + 1), end);
+        SweepPoint point;
+        point.footprint = (UINT32)jsonNumber(text, "footprint", pos, next, 0);
+        point.latency = jsonNumber(text, "latency_ns", pos, next, 0);
+        point.misses[0] = jsonNumber(text, "l1d_misses_per_load", pos, next, -1);
+        point.misses[1] = jsonNumber(text, "llc_misses_per_load", pos, next, -1);
+        sweep.push_back(point);
+        pos = next;
+    }
+    return !levels.empty();
+}
+
+// Set-associative caches for every measured level. A read goes down the
+// levels until one hits and is filled into each level that missed on the
+// way (non-inclusive, no back-invalidation).
+class CacheHierarchy
+{
+public:
+    CacheHierarchy(const std::vector<TopoLevel>& topo)
+    {
+        for (size_t i = 0; i < topo.size(); i++)
+        {
+            // measured sizes are not exact, so round the sets to a power of 2
+            double sets = (double)topo[i].size / topo[i].line / topo[i].ways;
+            UINT32 sets_log = sets < 1 ? 0 : UINT32(log2(sets) + 0.5);
+            m_levels.push_back(new SetAssoCache(sets_log, UINT32(log2(topo[i].line)), topo[i].ways));
+        }
+    }
+
+    ~CacheHierarchy()
+    {
+        for (size_t i = 0; i < m_levels.size(); i++)
+            delete m_levels[i];
+    }
+
+    // Read one address, return the level that served it (levels() for memory)
+    UINT32 read(UINT32 mem_addr)
+    {
+        UINT32 i = 0;
+        while (i < m_levels.size() && !m_levels[i]->readReq(mem_addr)) i++;
+        return i;
+    }
+
+    UINT32 levels() { return m_levels.size(); }
+
+private:
+    std::vector<CacheModel*> m_levels;
+};
+
+// Replay the cache_test size sweep on a hierarchy built from the topology
+// it measured: per footprint, the same single random cycle over one 8-byte
+// slot per 64B (Sattolo), an uncounted warm-up pass, then as many loads as
+// cache_test times. The test array is 2MB-aligned and backed by huge pages,
+// so indexing the model with offsets into it matches the physical indexing
+// of the hardware below 2MB. Each counted load costs the measured latency
+// of the level that serves it; the simulated ns/load and miss rates are
+// printed next to the measured ones.
+void validateTopology(const std::string& path)
+{
+    std::vector<TopoLevel> topo;
+    std::vector<SweepPoint> sweep;
+    double mem_latency;
+    if (!readTopology(path, topo, mem_latency, sweep))
+    {
+        fprintf(stderr, "cannot read the levels and size sweep of %s\n", path.c_str());
+        return;
+    }
+    printf("\nValidation against %s:\n", path.c_str());
+    for (size_t i = 0; i < topo.size(); i++)
+        printf("\tL%u: %u bytes, %u B lines, %u ways, %.2f ns\n", (UINT32)i + 1,
+               topo[i].size, topo[i].line, topo[i].ways, topo[i].latency);
+    printf("\tmemory: %.2f ns\n", mem_latency);
+    printf("footprint,measured_ns,simulated_ns,divergence%%,sim_l1_miss,measured_l1_miss,sim_llc_miss,measured_llc_miss\n");
+
+    double sum_div = 0, max_div = 0, sum_miss_err[2] = {0, 0};
+    UINT32 miss_points = 0;
+    for (size_t p = 0; p < sweep.size(); p++)
+    {
+        UINT32 slots = sweep[p].footprint / 64;
+        if (slots < 2) slots = 2;
+        std::vector<UINT32> cycle(slots);
+        for (UINT32 i = 0; i < slots; i++) cycle[i] = i;
+        srand(1);
+        for (UINT32 i = slots - 1; i > 0; i--)
+        {
+            UINT32 j = (((UINT32)rand() << 16) ^ rand()) % i;
+            std::swap(cycle[i], cycle[j]);
+        }
+
+        CacheHierarchy cache(topo);
+        UINT32 loads = 2 * slots < (1 << 20) ? (1 << 20) : 2 * slots;
+        std::vector<UINT64> served(cache.levels() + 1, 0);
+        UINT32 slot = 0;
+        for (UINT32 i = 0; i < slots + loads; i++)
+        {
+            UINT32 level = cache.read(slot * 64);
+            if (i >= slots) served[level]++;
+            slot = cycle[slot];
+        }
+
+        double sim_ns = served[cache.levels()] * mem_latency;
+        for (UINT32 l = 0; l < cache.levels(); l++)
+            sim_ns += served[l] * topo[l].latency;
+        sim_ns /= loads;
+        double sim_miss[2] = {1 - (double)served[0] / loads, (double)served[cache.levels()] / loads};
+        double div = 100 * (sim_ns - sweep[p].latency) / sweep[p].latency;
+        sum_div += fabs(div);
+        if (fabs(div) > max_div) max_div = fabs(div);
+        if (sweep[p].misses[0] >= 0)
+        {
+            miss_points++;
+            for (int m = 0; m < 2; m++)
+                sum_miss_err[m] += fabs(sim_miss[m] - sweep[p].misses[m]);
+        }
+
+        printf("%u,%.3f,%.3f,%.1f,%.4f,", sweep[p].footprint, sweep[p].latency, sim_ns, div, sim_miss[0]);
+        if (sweep[p].misses[0] >= 0) printf("%.4f,", sweep[p].misses[0]); else printf("-,");
+        printf("%.4f,", sim_miss[1]);
+        if (sweep[p].misses[1] >= 0) printf("%.4f\n", sweep[p].misses[1]); else printf("-\n");
+    }
+
+    printf("latency divergence: mean %.1f%%, max %.1f%% over %u footprints\n",
+           sum_div / sweep.size(), max_div, (UINT32)sweep.size());
+    if (miss_points)
+        printf("miss rate error (absolute, per load): L1 %.4f, LLC %.4f over %u footprints\n",
+               sum_miss_err[0] / miss_points, sum_miss_err[1] / miss_points, miss_points);
+    else
+        printf("measured miss rates unavailable (cache_test ran without PMU counters)\n");
+}
+
+/**************************************
+ * False Sharing Detector
+**************************************/
+// The bytes each thread writes to every block. A block written by two or
+// more threads at disjoint bytes is falsely shared: the threads never
+// communicate through it, yet with private caches every write invalidates
+// the other threads' copies. Writer switches (a write by a thread other
+// than the block's previous writer) count those invalidations and rank
+// the blocks. Blocks of up to 64 bytes only, one bit per byte.
+struct BlockWriters
+{
+    BlockWriters() : writes(0), switches(0), last_writer(INVALID_THREADID) {}
+
+    UINT64 writes;
+    UINT64 switches;
+    THREADID last_writer;
+    std::map<THREADID, UINT64> bytes;   // thread -> written bytes
+    std::map<THREADID, UINT32> pcs;     // thread -> its last writing pc
+};
+
+// A data section of a loaded image, for naming the falsely shared blocks
+struct DataSection
+{
+    ADDRINT end;
+    std::string name;       // image:section
+};
+
+class SharingDetector
+{
+public:
+    SharingDetector(UINT32 log_block_size, UINT32 top)
+        : m_blksz_log(log_block_size), m_top(top) {}
+
+    void write(ADDRINT addr, UINT32 size, UINT32 pc, THREADID tid)
+    {
+        ADDRINT blk = addr >> m_blksz_log;
+        UINT32 offset = addr & ((1 << m_blksz_log) - 1);
+        UINT32 end = std::min(offset + size, 1u << m_blksz_log);
+        if (end <= offset) return;
+        UINT64 bits = end - offset == 64 ? ~0ULL : ((1ULL << (end - offset)) - 1);
+
+        BlockWriters& b = m_blocks[blk];
+        b.writes++;
+        if (b.last_writer != tid && b.last_writer != INVALID_THREADID)
+            b.switches++;
+        b.last_writer = tid;
+        b.bytes[tid] |= bits << offset;
+        b.pcs[tid] = pc;
+    }
+
+    // Record the data sections and symbols of a loaded image
+    void addImage(IMG img)
+    {
+        std::string image = IMG_Name(img);
+        image = image.substr(image.find_last_of('/') + 1);
+        for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+        {
+            if (!SEC_Mapped(sec) || SEC_IsExecutable(sec) || SEC_Size(sec) == 0) continue;
+            DataSection& d = m_sections[SEC_Address(sec)];
+            d.end = SEC_Address(sec) + SEC_Size(sec);
+            d.name = image + ":" + SEC_Name(sec);
+        }
+        for (SYM sym = IMG_RegsymHead(img); SYM_Valid(sym); sym = SYM_Next(sym))
+            m_symbols[SYM_Address(sym)] = PIN_UndecorateSymbolName(SYM_Name(sym), UNDECORATION_NAME_ONLY);
+    }
+
+    // The falsely shared blocks with the most writer switches, each named
+    // by the data symbol (or else the image section) holding it
+    void dumpResults()
+    {
+        std::vector<std::pair<UINT64, ADDRINT> > shared;     // (switches, block)
+        for (std::map<ADDRINT, BlockWriters>::iterator it = m_blocks.begin(); it != m_blocks.end(); it++)
+            if (falselyShared(it->second))
+                shared.push_back(std::make_pair(it->second.switches, it->first));
+        std::sort(shared.rbegin(), shared.rend());
+
+        printf("\nFalse Sharing:\n");
+        printf("\tblocks written by several threads at disjoint bytes: %u of %u written\n",
+               (UINT32)shared.size(), (UINT32)m_blocks.size());
+        if (shared.size() > m_top) shared.resize(m_top);
+        printf("\ttop %u blocks by writer switches (block, data, switches, writes, threads: bytes @ pc):\n",
+               (UINT32)shared.size());
+        PIN_LockClient();
+        for (size_t i = 0; i < shared.size(); i++)
+        {
+            ADDRINT addr = shared[i].second << m_blksz_log;
+            BlockWriters& b = m_blocks[shared[i].second];
+            printf("\t\t0x%lx, %s, %lu, %lu,", (unsigned long)addr, dataName(addr).c_str(), b.switches, b.writes);
+            for (std::map<THREADID, UINT64>::iterator it = b.bytes.begin(); it != b.bytes.end(); it++)
+            {
+                std::string rtn = RTN_FindNameByAddress(b.pcs[it->first]);
+                printf(" T%d: %s @ 0x%x%s%s", it->first, byteRanges(it->second).c_str(), b.pcs[it->first],
+                       rtn.empty() ? "" : " ", rtn.c_str());
+            }
+            printf("\n");
+        }
+        PIN_UnlockClient();
+    }
+
+private:
+    UINT32 m_blksz_log;
+    UINT32 m_top;           // blocks to report
+    std::map<ADDRINT, BlockWriters> m_blocks;       // by address >> m_blksz_log
+    std::map<ADDRINT, DataSection> m_sections;      // by start address
+    std::map<ADDRINT, std::string> m_symbols;       // by address
+
+    static bool falselyShared(const BlockWriters& b)
+    {
+        if (b.bytes.size() < 2) return false;
+        UINT64 seen = 0;
+        for (std::map<THREADID, UINT64>::const_iterator it = b.bytes.begin(); it != b.bytes.end(); it++)
+        {
+            if (seen & it->second) return false;
+            seen |= it->second;
+        }
+        return true;
+    }
+
+    // symbol+offset if a symbol of the section precedes addr, else
+    // image:section+offset, else heap or stack
+    std::string dataName(ADDRINT addr)
+    {
+        std::map<ADDRINT, DataSection>::iterator sec = m_sections.upper_bound(addr);
+        if (sec == m_sections.begin() || (--sec)->second.end <= addr) return "heap/stack";
+
+        std::ostringstream name;
+        std::map<ADDRINT, std::string>::iterator sym = m_symbols.upper_bound(addr);
+        if (sym != m_symbols.begin() && (--sym)->first >= sec->first)
+            name << sym->second << "+0x" << std::hex << addr - sym->first;
+        else
+            name << sec->second.name << "+0x" << std::hex << addr - sec->first;
+        return name.str();
+    }
+
+    // The set bits of a byte mask as offset ranges, e.g. "0-7,16-23"
+    static std::string byteRanges(UINT64 bytes)
+    {
+        std::ostringstream ranges;
+        for (UINT32 i = 0; i < 64; i++)
+        {
+            if (!(bytes >> i & 1)) continue;
+            UINT32 j = i;
+            while (j < 63 && (bytes >> (j + 1) & 1)) j++;
+            ranges << (ranges.tellp() ? "," : "") << i << "-" << j;
+            i = j;
+        }
+        return ranges.str();
+    }
+};
+
+/**************************************
+ * TLBs and Page Walks
+**************************************/
+// With -tlb every access is translated before it reaches the caches: an L1
+// DTLB, then on a miss the STLB, then on a miss a page walk whose page table
+// entry reads fill the caches through CacheModel::walkRead, in their own tag
+// space and with their own counters. All pages have the -page size, so runs
+// with 4KB, 2MB and 1GB pages compare the TLB reach and walk cost of each.
+// There are no paging-structure caches; upper-level entries are shared by
+// many pages and mostly hit in the data caches.
+#define PT_LEVELS 4
+
+// Set-associative TLB over virtual page numbers with LRU replacement.
+// Each set keeps its entries most recently used first.
+class Tlb
+{
+public:
+    Tlb(UINT32 entries, UINT32 ways)
+        : m_entries(entries), m_ways(ways), m_sets(entries / ways), m_accesses(0), m_hits(0)
+    {
+        m_vpns = new UINT64[entries];
+        for (UINT32 i = 0; i < entries; i++)
+            m_vpns[i] = ~0ULL;
+    }
+
+    ~Tlb() { delete[] m_vpns; }
+
+    // The sets must be a power of 2
+    static bool validGeometry(UINT32 entries, UINT32 ways)
+    {
+        UINT32 sets = ways ? entries / ways : 0;
+        return sets && entries % ways == 0 && (sets & (sets - 1)) == 0;
+    }
+
+    // Look vpn up and insert it on a miss, return whether it hit
+    bool access(UINT64 vpn)
+    {
+        m_accesses++;
+        UINT64* set = m_vpns + (vpn & (m_sets - 1)) * m_ways;
+        UINT32 i = 0;
+        while (i < m_ways - 1 && set[i] != vpn) i++;
+        bool hit = set[i] == vpn;
+        memmove(set + 1, set, i * sizeof(UINT64));
+        set[0] = vpn;
+        if (hit) m_hits++;
+        return hit;
+    }
+
+    UINT32 entries() { return m_entries; }
+    UINT32 ways() { return m_ways; }
+    UINT64 accesses() { return m_accesses; }
+    UINT64 hits() { return m_hits; }
+
+private:
+    UINT32 m_entries;
+    UINT32 m_ways;
+    UINT32 m_sets;          // a power of 2
+    UINT64* m_vpns;         // ~0 marks an empty entry
+    UINT64 m_accesses;
+    UINT64 m_hits;
+};
+
+// x86-64 four-level page table. A walk reads one 8-byte entry per level
+// from the PML4 down to the level that maps the page: 4 for 4KB pages, 3
+// for 2MB and 2 for 1GB. Each table takes the next free 4KB frame of the
+// page table space when it is first used, so the entries of neighbouring
+// pages share cache blocks as in a real page table.
+class PageWalker
+{
+public:
+    PageWalker(UINT32 page_log)
+        : m_page_log(page_log), m_levels((48 - page_log) / 9), m_walks(0) {}
+
+    UINT32 pageLog() { return m_page_log; }
+    UINT32 levels() { return m_levels; }
+    UINT64 walks() { return m_walks; }
+    UINT64 tables() { return m_tables.size(); }
+
+    // Store the addresses of the entries the walk for vaddr reads in ptes,
+    // root first, and return their number
+    UINT32 walk(UINT64 vaddr, UINT32* ptes)
+    {
+        m_walks++;
+        for (UINT32 level = 0; level < m_levels; level++)
+        {
+            UINT32 shift = 39 - 9 * level;  // of this level's index bits
+            UINT64 key = (vaddr >> (shift + 9)) << 2 | level;
+            std::map<UINT64, UINT32>::iterator it = m_tables.find(key);
+            if (it == m_tables.end())
+                it = m_tables.insert(std::make_pair(key, (UINT32)m_tables.size())).first;
+            ptes[level] = (it->second << 12) + ((vaddr >> shift & 511) << 3);
+        }
+        return m_levels;
+    }
+
+private:
+    UINT32 m_page_log;
+    UINT32 m_levels;
+    UINT64 m_walks;
+    std::map<UINT64, UINT32> m_tables;  // (level, address bits above it) -> frame
+};
+
+CacheModel* my_fa_cache;
+CacheModel* my_dm_cache;
+CacheModel* my_sa_cache;
+ParallelSetAssoCache* my_par_sa_cache = NULL;   // replaces my_sa_cache with -workers
+CacheWorker* fa_worker = NULL;                  // with -workers, my_fa_cache and my_dm_cache
+CacheWorker* dm_worker = NULL;                  // run on a thread each
+
+double time_fa_rd = 0, time_fa_wr = 0;
+double time_dm_rd = 0, time_dm_wr = 0;
+double time_sa_rd = 0, time_sa_wr = 0;
+
+SharingDetector* sharing = NULL;    // with -fs
+
+// The simulated caches are shared by all application threads
+PIN_LOCK cache_lock;
+
+// With -tlb
+Tlb* dtlb = NULL;
+Tlb* stlb = NULL;
+PageWalker* walker = NULL;
+
+// Translate ea through the TLBs. On an STLB miss the page walk reads its
+// entries through the caches, ahead of the access that missed.
+void translate(ADDRINT ea)
+{
+    UINT64 vpn = ea >> walker->pageLog();
+    if (dtlb->access(vpn) || stlb->access(vpn)) return;
+
+    UINT32 ptes[PT_LEVELS];
+    UINT32 n = walker->walk(ea, ptes);
+    CacheModel* caches[3] = { my_fa_cache, my_dm_cache, my_sa_cache };
+    for (int c = 0; c < 3; c++)
+        for (UINT32 i = 0; i < n; i++)
+            caches[c]->walkRead(ptes[i]);
+}
+
+// Bytes as KB, MB or GB
+std::string sizeName(UINT64 bytes)
+{
+    const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    int u = 0;
+    while (u < 4 && bytes >= 1024 && bytes % 1024 == 0)
+    {
+        bytes /= 1024;
+        u++;
+    }
+    std::ostringstream name;
+    name << bytes << units[u];
+    return name.str();
+}
+
+// The walk latency charges hit_lat or miss_lat cycles per entry read, one
+// after the other since each read needs the entry above it
+void dumpTlb(UINT32 hit_lat, UINT32 miss_lat)
+{
+    UINT64 page = 1ULL << walker->pageLog();
+    printf("\nTLB (%s pages, %u entry reads per walk):\n", sizeName(page).c_str(), walker->levels());
+    Tlb* tlbs[2] = { dtlb, stlb };
+    const char* names[2] = { "L1 DTLB", "STLB" };
+    for (int t = 0; t < 2; t++)
+        printf("\t%s: %u entries, %u ways, reach %s,\taccesses: %lu,\thit rate: %.2f%%\n", names[t],
+               tlbs[t]->entries(), tlbs[t]->ways(), sizeName(page * tlbs[t]->entries()).c_str(), tlbs[t]->accesses(),
+               tlbs[t]->accesses() ? 100.0 * tlbs[t]->hits() / tlbs[t]->accesses() : 0.0);
+    UINT64 reads = walker->walks() * walker->levels();
+    printf("\tpage walks: %lu (%.3f per thousand accesses),\tpage tables: %s\n", walker->walks(),
+           dtlb->accesses() ? 1000.0 * walker->walks() / dtlb->accesses() : 0.0, sizeName(walker->tables() << 12).c_str());
+
+    const char* cache_names[3] = { "Fully Associative", "Directly Mapped", "Set-Associative" };
+    CacheModel* caches[3] = { my_fa_cache, my_dm_cache, my_sa_cache };
+    for (int c = 0; c < 3 && reads; c++)
+    {
+        UINT64 hits = caches[c]->getPteHit();
+        double cycles = (double)hits * hit_lat + (double)(reads - hits) * miss_lat;
+        printf("\t%s: entry read hit rate: %.2f%%,\taverage walk: %.1f cycles,\twalk cycles per access: %.3f\n",
+               cache_names[c], 100.0 * hits / reads, cycles / walker->walks(), cycles / dtlb->accesses());
+    }
+}
+
+// Cache reading analysis routine
+void readCache(UINT32 pc, ADDRINT ea, UINT32 size, THREADID tid)
+{
+    UINT32 mem_addr = ((UINT32)ea >> 2) << 2;
+    PIN_GetLock(&cache_lock, tid + 1);
+    if (walker) translate(ea);
+    clock_t pt0 = clock();
+    if (fa_worker) fa_worker->push(ea, size, false);
+    else
+    {
+        my_fa_cache->readReq(mem_addr, pc);
+        my_fa_cache->touchBytes(ea, size);
+    }
+    clock_t pt1 = clock();
+    if (dm_worker) dm_worker->push(ea, size, false);
+    else
+    {
+        my_dm_cache->readReq(mem_addr, pc);
+        my_dm_cache->touchBytes(ea, size);
+    }
+    clock_t pt2 = clock();
+    if (my_par_sa_cache) my_par_sa_cache->readReq(ea, size);
+    else
+    {
+        my_sa_cache->readReq(mem_addr, pc);
+        my_sa_cache->touchBytes(ea, size);
+    }
+    clock_t pt3 = clock();
+
+    time_fa_rd += 1000000*(double)(pt1 - pt0) / CLOCKS_PER_SEC;
+    time_dm_rd += 1000000*(double)(pt2 - pt1) / CLOCKS_PER_SEC;
+    time_sa_rd += 1000000*(double)(pt3 - pt2) / CLOCKS_PER_SEC;
+    PIN_ReleaseLock(&cache_lock);
+}
+
+// Cache writing analysis routine
+void writeCache(UINT32 pc, ADDRINT ea, UINT32 size, THREADID tid)
+{
+    UINT32 mem_addr = ((UINT32)ea >> 2) << 2;
+    PIN_GetLock(&cache_lock, tid + 1);
+    if (walker) translate(ea);
+    clock_t pt0 = clock();
+    if (fa_worker) fa_worker->push(ea, size, true);
+    else
+    {
+        my_fa_cache->writeReq(mem_addr, pc);
+        my_fa_cache->touchBytes(ea, size);
+    }
+    clock_t pt1 = clock();
+    if (dm_worker) dm_worker->push(ea, size, true);
+    else
+    {
+        my_dm_cache->writeReq(mem_addr, pc);
+        my_dm_cache->touchBytes(ea, size);
+    }
+    clock_t pt2 = clock();
+    if (my_par_sa_cache) my_par_sa_cache->writeReq(ea, size);
+    else
+    {
+        my_sa_cache->writeReq(mem_addr, pc);
+        my_sa_cache->touchBytes(ea, size);
+    }
+    clock_t pt3 = clock();
+
+    time_fa_wr += 1000000*(double)(pt1 - pt0) / CLOCKS_PER_SEC;
+    time_dm_wr += 1000000*(double)(pt2 - pt1) / CLOCKS_PER_SEC;
+    time_sa_wr += 1000000*(double)(pt3 - pt2) / CLOCKS_PER_SEC;
+    if (sharing) sharing->write(ea, size, pc, tid);
+    PIN_ReleaseLock(&cache_lock);
+}
+
+// Pin calls this function every time an image is loaded
+VOID ImageLoad(IMG img, VOID *v)
+{
+    PIN_GetLock(&cache_lock, 1);
+    sharing->addImage(img);
+    PIN_ReleaseLock(&cache_lock);
+}
+
+// This knob will set the cache param m_block_num
+KNOB<UINT32> KnobBlockNum(KNOB_MODE_WRITEONCE, "pintool",
+        "n", "512", "specify the number of blocks in bytes");
+
+// This knob will set the cache param m_blksz_log
+KNOB<UINT32> KnobBlockSizeLog(KNOB_MODE_WRITEONCE, "pintool",
         "b", "6", "specify the log of the block size in bytes");
 
 // This knob will set the cache param m_sets_log
@@ -346,50 +1926,807 @@ KNOB<UINT32> KnobSetsLog(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool",
         "a", "4", "specify the m_asso");
 
+// This knob will validate the model against a cache_test topology file
+KNOB<std::string> KnobTopology(KNOB_MODE_WRITEONCE, "pintool",
+        "topo", "", "replay the size sweep of a cache_test topology file on a hierarchy built from it");
+
+// These knobs turn on the miss classification and attribution
+KNOB<UINT32> KnobTopMisses(KNOB_MODE_WRITEONCE, "pintool",
+        "top", "0", "classify misses as compulsory/capacity/conflict and report the top N PCs and regions, 0 to disable");
+
+KNOB<UINT32> KnobRegionLog(KNOB_MODE_WRITEONCE, "pintool",
+        "region", "12", "specify the log of the data region size misses are attributed to");
+
+// These knobs measure how much of each block is used and by which threads
+KNOB<BOOL> KnobUtilization(KNOB_MODE_WRITEONCE, "pintool",
+        "util", "0", "histogram the bytes used of each block fetched (blocks of up to 64 bytes)");
+
+KNOB<UINT32> KnobFalseSharing(KNOB_MODE_WRITEONCE, "pintool",
+        "fs", "0", "detect blocks written by several threads at disjoint bytes and report the top N, 0 to disable");
+
+// These knobs start the caches from a checkpoint and save one at the end
+KNOB<std::string> KnobLoadCaches(KNOB_MODE_WRITEONCE, "pintool",
+        "loadcache", "", "start the caches from a checkpoint written by -savecache");
+
+KNOB<std::string> KnobSaveCaches(KNOB_MODE_WRITEONCE, "pintool",
+        "savecache", "", "write the cache state to a checkpoint when the application exits");
+
+KNOB<BOOL> KnobKeepStats(KNOB_MODE_WRITEONCE, "pintool",
+        "keepstats", "0", "continue the request counters of -loadcache instead of starting from zero");
+
+// These knobs time the accesses of each simulated cache
+KNOB<UINT32> KnobMshrs(KNOB_MODE_WRITEONCE, "pintool",
+        "mshr", "0", "simulate time with N MSHRs per cache, 0 to disable");
+
+KNOB<UINT32> KnobHitLatency(KNOB_MODE_WRITEONCE, "pintool",
+        "hitlat", "4", "specify the hit latency in cycles");
+
+KNOB<UINT32> KnobMissLatency(KNOB_MODE_WRITEONCE, "pintool",
+        "misslat", "200", "specify the memory latency of a miss in cycles");
+
+KNOB<UINT32> KnobL2SetsLog(KNOB_MODE_WRITEONCE, "pintool",
+        "l2sets", "0", "specify the log of the number of rows of an L2 behind each cache for -mshr, 0 for none");
+
+KNOB<UINT32> KnobL2Associativity(KNOB_MODE_WRITEONCE, "pintool",
+        "l2ways", "8", "specify the L2 associativity");
+
+KNOB<UINT32> KnobL2Latency(KNOB_MODE_WRITEONCE, "pintool",
+        "l2lat", "14", "specify the L2 hit latency in cycles");
+
+// This knob moves the set-associative cache onto worker threads
+KNOB<UINT32> KnobWorkers(KNOB_MODE_WRITEONCE, "pintool",
+        "workers", "0", "simulate the set-associative cache on N worker threads (a power of 2) owning disjoint sets, and the other two caches on a thread each; 0 for inline");
+
+// These knobs attach a prefetcher to each simulated cache
+KNOB<std::string> KnobPrefetcher(KNOB_MODE_WRITEONCE, "pintool",
+        "pf", "none", "prefetcher: none, next (next-N-line), stride (PC-indexed RPT) or stream (stream buffers)");
+
+KNOB<UINT32> KnobPrefetchDegree(KNOB_MODE_WRITEONCE, "pintool",
+        "pfdeg", "4", "specify the blocks, strides or stream depth the prefetcher runs ahead");
+
+KNOB<UINT32> KnobPrefetchDelay(KNOB_MODE_WRITEONCE, "pintool",
+        "pfdelay", "16", "specify the demand accesses between issuing a prefetch and its fill");
+
+// These knobs put TLBs in front of the caches; see the TLBs and Page Walks section
+KNOB<BOOL> KnobTlb(KNOB_MODE_WRITEONCE, "pintool",
+        "tlb", "0", "translate accesses through an L1 DTLB and an STLB, with page walks through the caches");
+
+KNOB<std::string> KnobPageSize(KNOB_MODE_WRITEONCE, "pintool",
+        "page", "4KB", "specify the page size: 4KB, 2MB or 1GB");
+
+KNOB<UINT32> KnobDtlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+        "dtlb", "64", "specify the L1 DTLB entries");
+
+KNOB<UINT32> KnobDtlbWays(KNOB_MODE_WRITEONCE, "pintool",
+        "dtlbways", "4", "specify the L1 DTLB associativity");
+
+KNOB<UINT32> KnobStlbEntries(KNOB_MODE_WRITEONCE, "pintool",
+        "stlb", "1536", "specify the STLB entries");
+
+KNOB<UINT32> KnobStlbWays(KNOB_MODE_WRITEONCE, "pintool",
+        "stlbways", "12", "specify the STLB associativity");
+
+// These knobs select sampled simulation; see the Sampling section
+KNOB<UINT64> KnobPeriod(KNOB_MODE_WRITEONCE, "pintool",
+        "period", "0", "specify the instructions per sampling period or SimPoint interval, 0 to simulate everything");
+
+KNOB<UINT64> KnobWarmup(KNOB_MODE_WRITEONCE, "pintool",
+        "warmup", "100000", "specify the instructions simulated without statistics before each detailed window");
+
+KNOB<UINT64> KnobDetail(KNOB_MODE_WRITEONCE, "pintool",
+        "detail", "10000", "specify the instructions of each periodic detailed window");
+
+KNOB<std::string> KnobBbv(KNOB_MODE_WRITEONCE, "pintool",
+        "bbv", "", "profile basic block vectors per interval into <file>.bb and choose SimPoints into <file>.simpoints");
+
+KNOB<std::string> KnobSimPoints(KNOB_MODE_WRITEONCE, "pintool",
+        "simpoints", "", "simulate only the intervals listed in a .simpoints file and extrapolate");
+
+KNOB<UINT32> KnobMaxPhases(KNOB_MODE_WRITEONCE, "pintool",
+        "maxk", "10", "specify the largest number of phases SimPoint clustering tries");
+
+KNOB<UINT32> KnobPerPhase(KNOB_MODE_WRITEONCE, "pintool",
+        "perphase", "2", "specify the intervals simulated per phase (2 or more give an error bound)");
+
+/**************************************
+ * Sampling
+**************************************/
+// Long runs are simulated in sampled windows. Instructions and memory
+// accesses are counted for the whole run at basic block entry, which is
+// cheap; the caches only see the accesses of warmup and detailed windows.
+//
+// periodic:  every -period instructions fast-forward, then update the
+//            caches for -warmup instructions without statistics (functional
+//            warmup), then simulate -detail instructions in detail
+// -bbv:      SimPoint profiling pass, no cache simulation. The basic block
+//            vector of each -period instruction interval is written in the
+//            SimPoint .bb format, randomly projected to PROJ_DIMS dimensions
+//            and clustered with k-means; the number of phases is the
+//            smallest k whose BIC is within 90% of the best. The -perphase
+//            intervals closest to each centroid are written to .simpoints
+//            with their phase and weight.
+// -simpoints: simulate only those intervals in detail, each after -warmup
+//            instructions of warmup
+//
+// Each detailed window yields a miss rate per cache. A phase's rate is the
+// mean of its windows and the estimate is the phase-weighted sum, with a 95%
+// confidence interval from the stratified variance sum(w^2 s^2 / n) over
+// phases with at least two windows (periodic sampling is a single phase).
+#define PROJ_DIMS 15
+#define SIM_CACHES 3
+
+enum SampleMode { SAMPLE_OFF, SAMPLE_PERIODIC, SAMPLE_PROFILE, SAMPLE_SIMPOINT };
+
+struct BlockInfo
+{
+    UINT32 id;              // 1-based, as SimPoint numbers blocks
+    UINT32 ins;
+    UINT32 mem_ops;
+    UINT64 count;           // instructions executed in this interval
+    double proj[PROJ_DIMS]; // random projection of this block's dimension
+};
+
+struct SampleWindow
+{
+    UINT32 phase;
+    double weight;          // of the phase this window represents
+    UINT64 reqs[SIM_CACHES];
+    UINT64 hits[SIM_CACHES];
+};
+
+CacheModel* sim_caches[SIM_CACHES];
+const char* sim_cache_names[SIM_CACHES] = { "Fully Associative", "Directly Mapped", "Set-Associative" };
+
+SampleMode sample_mode = SAMPLE_OFF;
+bool simulating = true;     // caches see accesses
+bool detailed = false;      // inside a detailed window
+UINT64 cur_interval = 0;    // interval being profiled, or of the open window
+UINT64 mem_count = 0;       // ins_count is in intervalLog.h
+UINT64 warm_ins = 0, detail_ins = 0;
+std::vector<SampleWindow> windows;
+std::map<UINT64, std::pair<UINT32, double> > simpoints;    // interval -> (phase, weight)
+
+std::map<ADDRINT, BlockInfo*> blocks;
+std::vector<BlockInfo*> touched_blocks;                     // count > 0 this interval
+std::vector<std::vector<double> > interval_bbvs;            // projected, normalized
+std::ofstream bb_out;
+
+// Snapshot the cache counters at the start of a detailed window and turn
+// them into the window's statistics at its end
+void openWindow(UINT32 phase, double weight)
+{
+    SampleWindow w;
+    w.phase = phase;
+    w.weight = weight;
+    for (int i = 0; i < SIM_CACHES; i++)
+    {
+        w.reqs[i] = sim_caches[i]->getRdReq() + sim_caches[i]->getWrReq();
+        w.hits[i] = sim_caches[i]->getRdHit() + sim_caches[i]->getWrHit();
+    }
+    windows.push_back(w);
+}
+
+void closeWindow()
+{
+    SampleWindow& w = windows.back();
+    for (int i = 0; i < SIM_CACHES; i++)
+    {
+        w.reqs[i] = sim_caches[i]->getRdReq() + sim_caches[i]->getWrReq() - w.reqs[i];
+        w.hits[i] = sim_caches[i]->getRdHit() + sim_caches[i]->getWrHit() - w.hits[i];
+    }
+}
+
+// End of a profiling interval: write its vector and keep its projection
+void flushInterval()
+{
+    UINT64 total = 0;
+    for (size_t i = 0; i < touched_blocks.size(); i++)
+        total += touched_blocks[i]->count;
+    if (total == 0) return;
+
+    std::vector<double> proj(PROJ_DIMS, 0);
+    bb_out << "T";
+    for (size_t i = 0; i < touched_blocks.size(); i++)
+    {
+        BlockInfo* b = touched_blocks[i];
+        bb_out << ":" << b->id << ":" << b->count << " ";
+        for (int d = 0; d < PROJ_DIMS; d++)
+            proj[d] += b->proj[d] * b->count / total;
+        b->count = 0;
+    }
+    bb_out << "\n";
+    touched_blocks.clear();
+    interval_bbvs.push_back(proj);
+}
+
+// Analysis routine at basic block entry: count, then decide whether the
+// caches see the block's accesses. Every application thread runs it, so the
+// sampling state, the windows and the interval rows change under cache_lock
+// like the cache counters they read; isSimulating only reads the flag.
+void countBlock(BlockInfo* b, THREADID tid)
+{
+    UINT64 period = KnobPeriod.Value();
+    UINT64 warmup = KnobWarmup.Value();
+    PIN_GetLock(&cache_lock, tid + 1);
+    bool was_detailed = detailed;
+
+    if (sample_mode == SAMPLE_PROFILE)
+    {
+        if (ins_count / period != cur_interval)
+        {
+            flushInterval();
+            cur_interval = ins_count / period;
+        }
+        if (b->count == 0) touched_blocks.push_back(b);
+        b->count += b->ins;
+    }
+    else if (sample_mode == SAMPLE_PERIODIC)
+    {
+        UINT64 pos = ins_count % period;
+        detailed = pos + KnobDetail.Value() >= period;
+        simulating = pos + warmup + KnobDetail.Value() >= period;
+        if (detailed && !was_detailed) openWindow(0, 1);
+    }
+    else if (sample_mode == SAMPLE_SIMPOINT)
+    {
+        UINT64 interval = ins_count / period;
+        std::map<UINT64, std::pair<UINT32, double> >::iterator it = simpoints.find(interval);
+        detailed = it != simpoints.end();
+        simulating = detailed || (simpoints.count(interval + 1) && ins_count + warmup >= (interval + 1) * period);
+        if (detailed && (!was_detailed || interval != cur_interval))
+        {
+            if (was_detailed) closeWindow();
+            openWindow(it->second.first, it->second.second);
+            cur_interval = interval;
+            was_detailed = false;
+        }
+    }
+    if (was_detailed && !detailed) closeWindow();
+
+    if (KnobInterval.Value() && ins_count >= next_row) logInterval();
+
+    if (detailed) detail_ins += b->ins;
+    else if (simulating) warm_ins += b->ins;
+    ins_count += b->ins;
+    mem_count += b->mem_ops;
+    PIN_ReleaseLock(&cache_lock);
+}
+
+// Pin calls this function for every new trace; blocks are shared by
+// address across traces so their counts and ids stay unique
+VOID Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        BlockInfo*& b = blocks[BBL_Address(bbl)];
+        if (!b)
+        {
+            b = new BlockInfo;
+            b->id = blocks.size();
+            b->ins = BBL_NumIns(bbl);
+            b->mem_ops = 0;
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+                b->mem_ops += INS_IsMemoryRead(ins) + INS_IsMemoryWrite(ins);
+            b->count = 0;
+            UINT32 seed = b->id * 2654435761u;
+            for (int d = 0; d < PROJ_DIMS; d++)
+            {
+                seed = seed * 1103515245 + 12345;
+                b->proj[d] = (double)(seed >> 8) / (1 << 23) - 1;
+            }
+        }
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countBlock, IARG_PTR, b, IARG_THREAD_ID, IARG_END);
+    }
+}
+
+BOOL isSimulating() { return simulating; }
+
+double sqDistance(const std::vector<double>& a, const std::vector<double>& b)
+{
+    double d = 0;
+    for (size_t i = 0; i < a.size(); i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+// k-means with k-means++ seeding; returns the BIC of the clustering under
+// the spherical Gaussian model SimPoint uses
+double kMeans(const std::vector<std::vector<double> >& points, UINT32 k,
+              std::vector<std::vector<double> >& centers, std::vector<UINT32>& label)
+{
+    size_t n = points.size();
+    srand(k);
+    centers.assign(1, points[rand() % n]);
+    std::vector<double> dist(n);
+    while (centers.size() < k)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            dist[i] = sqDistance(points[i], centers[0]);
+            for (size_t c = 1; c < centers.size(); c++)
+                dist[i] = std::min(dist[i], sqDistance(points[i], centers[c]));
+            sum += dist[i];
+        }
+        double r = sum * rand() / RAND_MAX;
+        size_t i = 0;
+        while (i < n - 1 && (r -= dist[i]) > 0) i++;
+        centers.push_back(points[i]);
+    }
+
+    label.assign(n, 0);
+    for (int iter = 0; iter < 100; iter++)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < n; i++)
+        {
+            UINT32 best = 0;
+            for (UINT32 c = 1; c < k; c++)
+                if (sqDistance(points[i], centers[c]) < sqDistance(points[i], centers[best])) best = c;
+            changed = changed || best != label[i];
+            label[i] = best;
+        }
+        if (!changed && iter > 0) break;
+        std::vector<UINT32> size(k, 0);
+        for (UINT32 c = 0; c < k; c++) centers[c].assign(PROJ_DIMS, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            size[label[i]]++;
+            for (int d = 0; d < PROJ_DIMS; d++) centers[label[i]][d] += points[i][d];
+        }
+        for (UINT32 c = 0; c < k; c++)
+            for (int d = 0; d < PROJ_DIMS; d++) centers[c][d] /= size[c] ? size[c] : 1;
+    }
+
+    // Pelleg and Moore's BIC with a variance shared by all clusters
+    std::vector<UINT32> size(k, 0);
+    double sse = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        size[label[i]]++;
+        sse += sqDistance(points[i], centers[label[i]]);
+    }
+    double var = n > k ? sse / (n - k) : 0;
+    if (var < 1e-12) var = 1e-12;
+    double loglike = 0;
+    for (UINT32 c = 0; c < k; c++)
+        if (size[c])
+            loglike += size[c] * log((double)size[c] / n) - size[c] / 2.0 * log(2 * M_PI)
+                     - size[c] * PROJ_DIMS / 2.0 * log(var) - (size[c] - 1.0) / 2.0;
+    double params = (k - 1) + PROJ_DIMS * k + 1;
+    return loglike - params / 2 * log((double)n);
+}
+
+// End of the profiling pass: cluster the intervals and write .simpoints
+void chooseSimPoints(const std::string& path)
+{
+    flushInterval();
+    if (interval_bbvs.empty()) return;
+
+    UINT32 max_k = std::min<UINT32>(KnobMaxPhases.Value(), interval_bbvs.size());
+    std::vector<std::vector<std::vector<double> > > centers(max_k + 1);
+    std::vector<std::vector<UINT32> > labels(max_k + 1);
+    std::vector<double> bic(max_k + 1);
+    double lo = 0, hi = 0;
+    for (UINT32 k = 1; k <= max_k; k++)
+    {
+        bic[k] = kMeans(interval_bbvs, k, centers[k], labels[k]);
+        if (k == 1 || bic[k] < lo) lo = bic[k];
+        if (k == 1 || bic[k] > hi) hi = bic[k];
+    }
+    UINT32 k = 1;
+    while (k < max_k && bic[k] - lo < 0.9 * (hi - lo)) k++;
+
+    std::ofstream out(path.c_str());
+    out << "# interval phase weight, " << interval_bbvs.size() << " intervals of "
+        << KnobPeriod.Value() << " instructions, " << k << " phases\n";
+    for (UINT32 c = 0; c < k; c++)
+    {
+        std::vector<std::pair<double, UINT32> > members;
+        for (size_t i = 0; i < interval_bbvs.size(); i++)
+            if (labels[k][i] == c)
+                members.push_back(std::make_pair(sqDistance(interval_bbvs[i], centers[k][c]), (UINT32)i));
+        if (members.empty()) continue;
+        std::sort(members.begin(), members.end());
+        double weight = (double)members.size() / interval_bbvs.size();
+        for (size_t m = 0; m < members.size() && m < KnobPerPhase.Value(); m++)
+            out << members[m].second << " " << c << " " << weight << "\n";
+    }
+    printf("\nSimPoint: %u intervals, %u phases, written to %s\n",
+           (UINT32)interval_bbvs.size(), k, path.c_str());
+}
+
+bool readSimPoints(const std::string& path)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        UINT64 interval;
+        UINT32 phase;
+        double weight;
+        if (fields >> interval >> phase >> weight) simpoints[interval] = std::make_pair(phase, weight);
+    }
+    return !simpoints.empty();
+}
+
+// Phase-weighted miss rate of every cache with its 95% confidence interval
+void dumpSampling()
+{
+    if (sample_mode == SAMPLE_PROFILE)
+    {
+        chooseSimPoints(KnobBbv.Value() + ".simpoints");
+        return;
+    }
+    if (detailed) closeWindow();
+
+    printf("\nSampled estimate: %lu instructions, %lu memory accesses, %.3f%% warmed, %.3f%% detailed in %u windows\n",
+           ins_count, mem_count, 100.0 * warm_ins / ins_count, 100.0 * detail_ins / ins_count, (UINT32)windows.size());
+    for (int c = 0; c < SIM_CACHES; c++)
+    {
+        std::map<UINT32, std::vector<double> > rates;      // per phase
+        std::map<UINT32, double> weights;
+        for (size_t i = 0; i < windows.size(); i++)
+            if (windows[i].reqs[c])
+            {
+                rates[windows[i].phase].push_back(1 - (double)windows[i].hits[c] / windows[i].reqs[c]);
+                weights[windows[i].phase] = windows[i].weight;
+            }
+
+        double estimate = 0, variance = 0, weight_sum = 0;
+        for (std::map<UINT32, std::vector<double> >::iterator it = rates.begin(); it != rates.end(); it++)
+        {
+            std::vector<double>& r = it->second;
+            double w = weights[it->first], mean = 0, s2 = 0;
+            for (size_t i = 0; i < r.size(); i++) mean += r[i] / r.size();
+            for (size_t i = 0; i < r.size(); i++) s2 += (r[i] - mean) * (r[i] - mean);
+            if (r.size() > 1) variance += w * w * s2 / (r.size() - 1) / r.size();
+            estimate += w * mean;
+            weight_sum += w;
+        }
+        if (weight_sum > 0) estimate /= weight_sum;
+        double ci = 1.96 * sqrt(variance) / (weight_sum > 0 ? weight_sum : 1);
+        printf("%s Cache:\tmiss rate: %.2f%% +- %.2f%%,\testimated misses: %.0f\n",
+               sim_cache_names[c], 100 * estimate, 100 * ci, estimate * mem_count);
+    }
+}
+
+/**************************************
+ * Interval Statistics
+**************************************/
+// The -interval rows (see intervalLog.h) carry the accesses, hit rate and
+// MPKI of each cache. The instruction count comes from the basic block
+// counts of the Sampling section, so -interval cannot be combined with
+// sampling.
+UINT64 row_reqs[SIM_CACHES];        // cache counters when the last row was written
+UINT64 row_misses[SIM_CACHES];
+
+// Columns of the caches: accesses, hit rate (%) and misses per thousand
+// instructions of each cache
+std::string cacheIntervalHeader()
+{
+    const char* tags[SIM_CACHES] = { "fa", "dm", "sa" };
+    std::string header;
+    for (int i = 0; i < SIM_CACHES; i++)
+        header = header + "," + tags[i] + "_accesses," + tags[i] + "_hit_rate," + tags[i] + "_mpki";
+    return header;
+}
+
+// Append the columns of the caches for an interval of ins instructions to
+// row and start the next interval
+int cacheIntervalColumns(char* row, int size, UINT64 ins)
+{
+    int n = 0;
+    for (int i = 0; i < SIM_CACHES; i++)
+    {
+        UINT64 reqs = sim_caches[i]->getRdReq() + sim_caches[i]->getWrReq();
+        UINT64 misses = reqs - sim_caches[i]->getRdHit() - sim_caches[i]->getWrHit();
+        UINT64 d_reqs = reqs - row_reqs[i];
+        UINT64 d_misses = misses - row_misses[i];
+        n += snprintf(row + n, size - n, ",%lu,%.2f,%.3f", d_reqs,
+                      d_reqs ? 100.0 * (d_reqs - d_misses) / d_reqs : 0.0,
+                      ins ? 1000.0 * d_misses / ins : 0.0);
+        row_reqs[i] = reqs;
+        row_misses[i] = misses;
+    }
+    return n;
+}
+
+void startCacheIntervals()
+{
+    for (int i = 0; i < SIM_CACHES; i++)
+    {
+        row_reqs[i] = sim_caches[i]->getRdReq() + sim_caches[i]->getWrReq();
+        row_misses[i] = row_reqs[i] - sim_caches[i]->getRdHit() - sim_caches[i]->getWrHit();
+    }
+}
+
+/**************************************
+ * Checkpoints
+**************************************/
+// A checkpoint (see checkpoint.h) holds the state of the three simulated
+// caches at the end of a run, so that later runs start from it warm instead
+// of replaying the warmup: one CacheModel image per cache. A checkpoint of
+// another version, or of caches with another geometry, is refused.
+#define CKPT_MAGIC "CACHECKP"
+#define CKPT_VERSION 1
+
+// Save the caches to state or restore them from it, then close it
+bool transferCacheCheckpoint(CheckpointState& state, bool keep_stats)
+{
+    state.header(CKPT_MAGIC, CKPT_VERSION, SIM_CACHES);
+    for (int i = 0; i < SIM_CACHES && state.ok; i++)
+        sim_caches[i]->transfer(state, keep_stats);
+    return state.close();
+}
+
+bool saveCacheCheckpoint(const std::string& path)
+{
+    CheckpointState state;
+    return state.save(path) && transferCacheCheckpoint(state, false);
+}
+
+bool loadCacheCheckpoint(const std::string& path, bool keep_stats)
+{
+    CheckpointState state;
+    return state.restore(path) && transferCacheCheckpoint(state, keep_stats);
+}
+
+#ifndef UNIFIED_TOOL
 // Pin calls this function every time a new instruction is encountered
 VOID Instruction(INS ins, VOID *v)
 {
+    if (sample_mode == SAMPLE_PROFILE) return;
+    if (sample_mode != SAMPLE_OFF)
+    {
+        if (INS_IsMemoryRead(ins))
+        {
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)isSimulating, IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)readCache, IARG_INST_PTR, IARG_MEMORYREAD_EA,
+                               IARG_MEMORYREAD_SIZE, IARG_THREAD_ID, IARG_END);
+        }
+        if (INS_IsMemoryWrite(ins))
+        {
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)isSimulating, IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)writeCache, IARG_INST_PTR, IARG_MEMORYWRITE_EA,
+                               IARG_MEMORYWRITE_SIZE, IARG_THREAD_ID, IARG_END);
+        }
+        return;
+    }
     if (INS_IsMemoryRead(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readCache, IARG_MEMORYREAD_EA, IARG_END);
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)readCache, IARG_INST_PTR, IARG_MEMORYREAD_EA,
+                       IARG_MEMORYREAD_SIZE, IARG_THREAD_ID, IARG_END);
     if (INS_IsMemoryWrite(ins))
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)writeCache, IARG_MEMORYWRITE_EA, IARG_END);
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)writeCache, IARG_INST_PTR, IARG_MEMORYWRITE_EA,
+                       IARG_MEMORYWRITE_SIZE, IARG_THREAD_ID, IARG_END);
 }
+#endif
 
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
+    if (sample_mode == SAMPLE_PROFILE)
+    {
+        dumpSampling();
+        return;
+    }
+    closeIntervalLog();
+    if (!KnobSaveCaches.Value().empty() && !saveCacheCheckpoint(KnobSaveCaches.Value()))
+        fprintf(stderr, "cannot write the checkpoint %s\n", KnobSaveCaches.Value().c_str());
+
     printf("\nFully Associative Cache:\n");
     printf("average read time: %.2fus\n", time_fa_rd/my_fa_cache->getRdReq());
     printf("average write time: %.2fus\n", time_fa_rd/my_fa_cache->getWrReq());
     my_fa_cache->dumpResults();
+    my_fa_cache->dumpMissStats();
+    my_fa_cache->dumpUtilization();
+    my_fa_cache->dumpTiming();
     printf("\nDirectly Mapped Cache:\n");
     printf("average read time: %.2fus\n", time_dm_rd/my_dm_cache->getRdReq());
     printf("average write time: %.2fus\n", time_dm_rd/my_dm_cache->getWrReq());
     my_dm_cache->dumpResults();
-    printf("\nSet-Associative Cache:\n");
-    printf("average read time: %.2fus\n", time_sa_rd/my_sa_cache->getRdReq());
-    printf("average write time: %.2fus\n", time_sa_rd/my_sa_cache->getWrReq());
-    my_sa_cache->dumpResults();
+    my_dm_cache->dumpMissStats();
+    my_dm_cache->dumpUtilization();
+    my_dm_cache->dumpTiming();
+    if (my_par_sa_cache)
+    {
+        // with workers, time_*_rd and time_*_wr only cover handing the
+        // accesses over
+        printf("\nSet-Associative Cache (%u set-partitioned workers):\n", my_par_sa_cache->workers());
+        printf("average read time: %.2fus\n", time_sa_rd/my_par_sa_cache->getRdReq());
+        printf("average write time: %.2fus\n", time_sa_wr/my_par_sa_cache->getWrReq());
+        my_par_sa_cache->dumpResults();
+        delete my_par_sa_cache;
+    }
+    else
+    {
+        printf("\nSet-Associative Cache:\n");
+        printf("average read time: %.2fus\n", time_sa_rd/my_sa_cache->getRdReq());
+        printf("average write time: %.2fus\n", time_sa_rd/my_sa_cache->getWrReq());
+        my_sa_cache->dumpResults();
+        my_sa_cache->dumpMissStats();
+        my_sa_cache->dumpUtilization();
+        my_sa_cache->dumpTiming();
+    }
+    if (walker)
+    {
+        dumpTlb(KnobHitLatency.Value(), KnobMissLatency.Value());
+        delete dtlb;
+        delete stlb;
+        delete walker;
+    }
+    if (sample_mode != SAMPLE_OFF)
+        dumpSampling();
+    if (sharing)
+    {
+        sharing->dumpResults();
+        delete sharing;
+    }
 
+    delete fa_worker;
+    delete dm_worker;
     delete my_fa_cache;
     delete my_dm_cache;
     delete my_sa_cache;
 }
 
-// argc, argv are the entire command line, including pin -t <toolname> -- ...
-int main(int argc, char* argv[])
+// Pin calls this function before Fini, while internal threads still run
+VOID PrepareForFini(VOID *v)
 {
-    // Initialize pin
-    PIN_Init(argc, argv);
+    if (my_par_sa_cache)
+    {
+        fa_worker->close();
+        dm_worker->close();
+        my_par_sa_cache->finish();
+        fa_worker->join();
+        dm_worker->join();
+    }
+    IntervalPrepareForFini(v);
+}
 
+// Build the caches and their add-ons from the knobs, false on a bad combination
+BOOL initCaches()
+{
     my_fa_cache = new FullAssoCache(KnobBlockNum.Value(), KnobBlockSizeLog.Value());
     my_dm_cache = new DirectMapCache(KnobBlockNum.Value(), KnobBlockSizeLog.Value());
     my_sa_cache = new SetAssoCache(KnobSetsLog.Value(), KnobBlockSizeLog.Value(), KnobAssociativity.Value());
 
+    sim_caches[0] = my_fa_cache;
+    sim_caches[1] = my_dm_cache;
+    sim_caches[2] = my_sa_cache;
+    for (int i = 0; i < SIM_CACHES; i++)
+    {
+        Prefetcher* prefetcher = makePrefetcher(KnobPrefetcher.Value(), KnobPrefetchDegree.Value());
+        if (prefetcher) sim_caches[i]->attachPrefetcher(prefetcher, KnobPrefetchDelay.Value());
+        if (KnobTopMisses.Value()) sim_caches[i]->enableMissStats(KnobRegionLog.Value(), KnobTopMisses.Value());
+        if (KnobMshrs.Value())
+        {
+            TimingModel* timing = new TimingModel(KnobHitLatency.Value(), KnobMissLatency.Value(), KnobMshrs.Value());
+            if (KnobL2SetsLog.Value())
+                timing->addLevel(new SetAssoCache(KnobL2SetsLog.Value(), KnobBlockSizeLog.Value(),
+                                                  KnobL2Associativity.Value()), KnobL2Latency.Value());
+            sim_caches[i]->attachTiming(timing);
+        }
+        if (KnobUtilization.Value())
+            sim_caches[i]->enableLineStats();
+    }
+    if ((KnobUtilization.Value() || KnobFalseSharing.Value()) && KnobBlockSizeLog.Value() > 6)
+    {
+        fprintf(stderr, "-util and -fs need blocks of up to 64 bytes\n");
+        return FALSE;
+    }
+    if (KnobFalseSharing.Value())
+        sharing = new SharingDetector(KnobBlockSizeLog.Value(), KnobFalseSharing.Value());
+    PIN_InitLock(&cache_lock);
+
+    if (KnobTlb.Value())
+    {
+        const std::string& page = KnobPageSize.Value();
+        UINT32 page_log = page == "4KB" ? 12 : page == "2MB" ? 21 : page == "1GB" ? 30 : 0;
+        if (!page_log)
+        {
+            fprintf(stderr, "-page must be 4KB, 2MB or 1GB\n");
+            return FALSE;
+        }
+        if (!Tlb::validGeometry(KnobDtlbEntries.Value(), KnobDtlbWays.Value())
+            || !Tlb::validGeometry(KnobStlbEntries.Value(), KnobStlbWays.Value()))
+        {
+            fprintf(stderr, "TLB entries must be a power-of-2 number of sets times the ways\n");
+            return FALSE;
+        }
+        dtlb = new Tlb(KnobDtlbEntries.Value(), KnobDtlbWays.Value());
+        stlb = new Tlb(KnobStlbEntries.Value(), KnobStlbWays.Value());
+        walker = new PageWalker(page_log);
+    }
+
+    if (!KnobBbv.Value().empty() || !KnobSimPoints.Value().empty())
+    {
+        if (KnobPeriod.Value() == 0)
+        {
+            fprintf(stderr, "-bbv and -simpoints need the interval length in -period\n");
+            return FALSE;
+        }
+        if (!KnobBbv.Value().empty())
+        {
+            sample_mode = SAMPLE_PROFILE;
+            bb_out.open((KnobBbv.Value() + ".bb").c_str());
+        }
+        else if (readSimPoints(KnobSimPoints.Value()))
+            sample_mode = SAMPLE_SIMPOINT;
+        else
+        {
+            fprintf(stderr, "cannot read intervals from %s\n", KnobSimPoints.Value().c_str());
+            return FALSE;
+        }
+        simulating = false;
+    }
+    else if (KnobPeriod.Value())
+        sample_mode = SAMPLE_PERIODIC;
+
+    if (KnobWorkers.Value())
+    {
+        if (sample_mode != SAMPLE_OFF || KnobTopMisses.Value() || KnobPrefetcher.Value() != "none" || KnobMshrs.Value()
+            || !KnobLoadCaches.Value().empty() || !KnobSaveCaches.Value().empty() || walker)
+        {
+            fprintf(stderr, "-workers simulates plain LRU sets; it cannot be combined with -pf, -top, -mshr, -tlb, checkpoints or sampling\n");
+            return FALSE;
+        }
+        UINT32 workers_log = 0;
+        while ((2u << workers_log) <= KnobWorkers.Value()) workers_log++;
+        my_par_sa_cache = new ParallelSetAssoCache(KnobSetsLog.Value(), KnobBlockSizeLog.Value(),
+                                                   KnobAssociativity.Value(), workers_log);
+        fa_worker = new CacheWorker(my_fa_cache);
+        dm_worker = new CacheWorker(my_dm_cache);
+        if (!my_par_sa_cache->start() || !fa_worker->start() || !dm_worker->start())
+        {
+            fprintf(stderr, "cannot spawn the worker threads\n");
+            return FALSE;
+        }
+    }
+
+    if (!KnobLoadCaches.Value().empty() && !loadCacheCheckpoint(KnobLoadCaches.Value(), KnobKeepStats.Value()))
+    {
+        fprintf(stderr, "cannot load a checkpoint of these caches from %s\n", KnobLoadCaches.Value().c_str());
+        return FALSE;
+    }
+
+    if (!KnobTopology.Value().empty())
+        validateTopology(KnobTopology.Value());
+    startCacheIntervals();
+    return TRUE;
+}
+
+#ifndef UNIFIED_TOOL
+// argc, argv are the entire command line, including pin -t <toolname> -- ...
+int main(int argc, char* argv[])
+{
+    // Initialize pin
+    PIN_Init(argc, argv);
+    if (!initCaches()) return 1;
+    if (KnobInterval.Value())
+    {
+        if (sample_mode != SAMPLE_OFF || my_par_sa_cache)
+        {
+            fprintf(stderr, "-interval cannot be combined with sampling or -workers\n");
+            return 1;
+        }
+        if (!openIntervalLog(cacheIntervalHeader(), cacheIntervalColumns)) return 1;
+    }
+
     // Register Instruction to be called to instrument instructions
     INS_AddInstrumentFunction(Instruction, 0);
+    if (sample_mode != SAMPLE_OFF || interval_log)
+        TRACE_AddInstrumentFunction(Trace, 0);
+    if (sharing)
+    {
+        // Symbols name the falsely shared blocks
+        PIN_InitSymbols();
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+    }
 
     // Register Fini to be called when the application exits
+    PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     // Start the program, never returns
@@ -397,3 +2734,4 @@ int main(int argc, char* argv[])
 
     return 0;
 }
+#endif
@@ -0,0 +1,244 @@
+/*
+ * One Pin run for the three analyses of labs 1-3: register dependency
+ * distances (insDependDist.cpp), branch prediction (brchPredict.cpp) and
+ * the cache models (cacheModel.cpp). The tools are compiled in here with
+ * UNIFIED_TOOL defined, which leaves out their own instrumentation and
+ * main; their analysis routines, knobs and reports are shared, so every
+ * knob of the three tools works here too, except the -mix instruction mix
+ * of insDependDist.cpp, which needs its own basic block counts. Their -o
+ * knobs clash and are -depo and -brcho here.
+ *
+ * Instrumentation is a single pass: each instruction that an enabled
+ * analyzer needs appends one Event to a per-thread Pin trace buffer, and
+ * no analysis routine runs inline. When a thread's buffer fills or the
+ * thread exits, the enabled analyzers consume its events in program order,
+ * under a lock because their state is global. With several threads the
+ * analyzers therefore see the threads interleaved a buffer at a time
+ * rather than an instruction at a time.
+ *
+ * Sampling and -workers need the cache models to run in step with the
+ * program, so they are only available in cacheModel.cpp.
+ *
+ * With -interval N every instruction appends an Event, and each row of the
+ * -ilog file covers N consumed events: the mean dependency distance and the
+ * columns of brchPredict.cpp and cacheModel.cpp for the enabled analyses,
+ * so their spikes line up on one instruction axis.
+ */
+#include <cstddef>
+#include "pin.H"
+#include "../common/intervalLog.h"
+
+// These knobs choose the analyses
+KNOB<BOOL> KnobDepend(KNOB_MODE_WRITEONCE, "pintool",
+        "depend", "1", "analyze register dependency distances");
+
+KNOB<BOOL> KnobBranch(KNOB_MODE_WRITEONCE, "pintool",
+        "branch", "1", "simulate the branch predictor");
+
+KNOB<BOOL> KnobCache(KNOB_MODE_WRITEONCE, "pintool",
+        "cache", "1", "simulate the caches");
+
+// These knobs replace the tools' -o
+KNOB<std::string> KnobDependOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+        "depo", "insDependDist.csv", "specify the dependency distance output file name");
+
+KNOB<std::string> KnobBrchOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+        "brcho", "brchPredict.txt", "specify the branch prediction output file name");
+
+#define UNIFIED_TOOL
+
+#define OutFile DependOutFile
+#define KnobOutputFile KnobDependOutputFile
+#define Fini DependFini
+#include "../1190303311_王志军_ARCH_实验1/insDependDist.cpp"
+#undef OutFile
+#undef KnobOutputFile
+#undef Fini
+
+#define Fini CacheFini
+#include "cacheModel.cpp"
+#undef Fini
+
+// brchPredict.cpp defines a truncate() macro, so it comes last
+#define OutFile BrchOutFile
+#define KnobOutputFile KnobBrchOutputFile
+#define Fini BrchFini
+#include "../1190303311_王志军_ARCH_实验2/brchPredict.cpp"
+#undef OutFile
+#undef KnobOutputFile
+#undef Fini
+
+#define EVENT_BUF_PAGES 64      // trace buffer pages per thread
+
+// What the analyzers need from an instruction, fixed at instrumentation
+struct InsInfo
+{
+    Registers* regs;    // for the dependency analysis, or NULL
+    BOOL branch;        // taken is valid
+    BOOL read;          // read_ea and read_size are valid
+    BOOL write;         // write_ea and write_size are valid
+};
+
+// One executed instruction in a trace buffer
+struct Event
+{
+    ADDRINT pc;
+    InsInfo* info;
+    ADDRINT read_ea;
+    ADDRINT write_ea;
+    UINT32 read_size;
+    UINT32 write_size;
+    BOOL taken;
+};
+
+BUFFER_ID event_buf;
+PIN_LOCK events_lock;
+UINT64 row_dep_count = 0;       // dependency histogram when the last row was written
+double row_dep_sum = 0;
+
+// The columns of the enabled analyses for an interval of ins consumed
+// events; ins_count of intervalLog.h counts the events here
+int unifiedIntervalColumns(char* row, int size, UINT64 ins)
+{
+    int n = 0;
+    if (KnobDepend.Value())
+    {
+        UINT64 count = insDependDistance->recorded() - row_dep_count;
+        double sum = insDependDistance->sum() - row_dep_sum;
+        n += snprintf(row + n, size - n, ",%lu,%.2f", count, count ? sum / count : 0.0);
+        row_dep_count += count;
+        row_dep_sum += sum;
+    }
+    if (KnobBranch.Value()) n += brchIntervalColumns(row + n, size - n, ins);
+    if (KnobCache.Value()) n += cacheIntervalColumns(row + n, size - n, ins);
+    return n;
+}
+
+// Pin calls this function when a thread's buffer is full or the thread
+// exits; the events go to the analysis routines of the three tools
+VOID* consumeEvents(BUFFER_ID id, THREADID tid, const CONTEXT* ctxt, VOID* buf, UINT64 numElements, VOID* v)
+{
+    PIN_GetLock(&events_lock, tid + 1);
+    Event* events = (Event*)buf;
+    for (UINT64 i = 0; i < numElements; i++)
+    {
+        const Event& e = events[i];
+        if (e.info->regs) updateInsDependDistance(e.info->regs);
+        if (e.info->branch) predictBranch(e.pc, e.taken);
+        if (e.info->read) readCache(e.pc, e.read_ea, e.read_size, tid);
+        if (e.info->write) writeCache(e.pc, e.write_ea, e.write_size, tid);
+        if (interval_log && ++ins_count >= next_row) logInterval();
+    }
+    PIN_ReleaseLock(&events_lock);
+    return buf;
+}
+
+// Pin calls this function every time a new instruction is encountered
+VOID Instruction(INS ins, VOID *v)
+{
+    InsInfo* info = new InsInfo;
+    info->regs = KnobDepend.Value() ? insRegisters(ins) : NULL;
+    info->branch = KnobBranch.Value() && INS_IsControlFlow(ins) && INS_HasFallThrough(ins);
+    info->read = KnobCache.Value() && INS_IsMemoryRead(ins);
+    info->write = KnobCache.Value() && INS_IsMemoryWrite(ins);
+    if (!info->regs && !info->branch && !info->read && !info->write && !interval_log)
+    {
+        delete info;
+        return;
+    }
+
+    IARGLIST args = IARGLIST_Alloc();
+    IARGLIST_AddArguments(args, IARG_INST_PTR, offsetof(Event, pc),
+                          IARG_PTR, info, offsetof(Event, info), IARG_END);
+    if (info->branch)
+        IARGLIST_AddArguments(args, IARG_BRANCH_TAKEN, offsetof(Event, taken), IARG_END);
+    if (info->read)
+        IARGLIST_AddArguments(args, IARG_MEMORYREAD_EA, offsetof(Event, read_ea),
+                              IARG_MEMORYREAD_SIZE, offsetof(Event, read_size), IARG_END);
+    if (info->write)
+        IARGLIST_AddArguments(args, IARG_MEMORYWRITE_EA, offsetof(Event, write_ea),
+                              IARG_MEMORYWRITE_SIZE, offsetof(Event, write_size), IARG_END);
+    INS_InsertFillBuffer(ins, IPOINT_BEFORE, event_buf, IARG_IARGLIST, args, IARG_END);
+    IARGLIST_Free(args);
+}
+
+// This function is called when the application exits, after every
+// thread's buffer has been consumed
+VOID Fini(INT32 code, VOID *v)
+{
+    closeIntervalLog();         // before the tools' Fini, which would write rows of their own
+    if (KnobDepend.Value()) DependFini(code, v);
+    if (KnobBranch.Value()) BrchFini(code, v);
+    if (KnobCache.Value()) CacheFini(code, v);
+}
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool runs the dependency distance, branch prediction and cache analyses in one pass" << endl;
+    cerr << endl << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+/*   argc, argv are the entire command line: pin -t <toolname> -- ...    */
+/* ===================================================================== */
+
+int main(int argc, char * argv[])
+{
+    // Initialize pin
+    if (PIN_Init(argc, argv)) return Usage();
+
+    if (KnobDepend.Value() && !initDependDist()) return Usage();
+    if (KnobBranch.Value() && !initBrchPredict()) return Usage();
+    if (KnobCache.Value())
+    {
+        if (KnobPeriod.Value() || !KnobBbv.Value().empty() || !KnobSimPoints.Value().empty() || KnobWorkers.Value())
+        {
+            cerr << "sampling and -workers need cacheModel.cpp" << endl;
+            return Usage();
+        }
+        if (!initCaches()) return Usage();
+    }
+
+    event_buf = PIN_DefineTraceBuffer(sizeof(Event), EVENT_BUF_PAGES, consumeEvents, 0);
+    if (event_buf == BUFFER_ID_INVALID)
+    {
+        cerr << "cannot allocate the event buffers" << endl;
+        return 1;
+    }
+    PIN_InitLock(&events_lock);
+
+    if (KnobInterval.Value())
+    {
+        std::string header;
+        if (KnobDepend.Value()) header += ",dep_distances,dep_mean";
+        if (KnobBranch.Value()) header += brchIntervalHeader();
+        if (KnobCache.Value()) header += cacheIntervalHeader();
+        if (!openIntervalLog(header, unifiedIntervalColumns)) return 1;
+    }
+
+    // Register Instruction to be called to instrument instructions
+    INS_AddInstrumentFunction(Instruction, 0);
+    if (sharing)
+    {
+        PIN_InitSymbols();
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+    }
+
+    // Register Fini to be called when the application exits
+    // IntervalPrepareForFini stops the -ilog writer; buffers of exiting
+    // threads may still be consumed after it
+    if (interval_log) PIN_AddPrepareForFiniFunction(IntervalPrepareForFini, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Start the program, never returns
+    PIN_StartProgram();
+
+    return 0;
+}
@@ -1,246 +1,1306 @@
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
 #include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#endif
 
 using namespace std;
 
 #define ARRAY_SIZE (1 << 28) // test array size is 2^28
 typedef unsigned char BYTE;	 // define BYTE as one-byte type
-#define SIZE_TEST_TIMES 123456789
-#define WAY_TEST_TIMES 99999
+#define HUGE_PAGE_SIZE (2 << 20)
 
-BYTE array[ARRAY_SIZE]; // test array
-int L1_cache_size = 1 << 15;
-int L2_cache_size = 1 << 18;
-int L1_cache_block = 64;
-int L2_cache_block = 64;
-int L1_way_count = 8;
-int L2_way_count = 4;
-int write_policy = 0; // 0 for write back ; 1 for write through
+BYTE *test_array; // test array, see Alloc_Test_Array
+const char *array_pages = "4KB"; // page size backing the test array
 
-// have an access to arrays with L2 Data Cache'size to clear the L1 cache
-void Clear_L1_Cache()
+// monotonic wall-clock time in milliseconds with nanosecond resolution
+double Now_Ms()
 {
-	memset(array, 0, L2_cache_size);
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return 1000.0 * now.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
 }
 
-// have an access to arrays with ARRAY_SIZE to clear the L2 cache
-void Clear_L2_Cache()
+// Back the test array with huge pages so TLB misses do not add to the
+// measured latencies: explicit hugetlbfs pages first, then transparent
+// huge pages, then ordinary pages.
+BYTE *Alloc_Test_Array()
 {
-	memset(&array[L2_cache_size + 1], 0, ARRAY_SIZE - L2_cache_size);
+#ifdef __linux__
+	void *p = mmap(NULL, ARRAY_SIZE, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	{
+		array_pages = "2MB-hugetlbfs";
+		return (BYTE *)p;
+	}
+	if (posix_memalign(&p, HUGE_PAGE_SIZE, ARRAY_SIZE) != 0)
+		return NULL;
+	if (madvise(p, ARRAY_SIZE, MADV_HUGEPAGE) == 0)
+		array_pages = "2MB-thp";
+	return (BYTE *)p;
+#else
+	return (BYTE *)malloc(ARRAY_SIZE);
+#endif
+}
+
+// Pin the process to one CPU and raise its priority so the scheduler
+// does not migrate or preempt it in the middle of a measurement
+void Pin_To_Cpu(int cpu)
+{
+#ifdef _WIN32
+	SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		cerr << "warning: cannot pin to cpu " << cpu << endl;
+	setpriority(PRIO_PROCESS, 0, -20); // only succeeds with privileges
+#endif
+}
+
+// one cache as described by /sys/devices/system/cpu/cpuN/cache/indexM
+struct SysfsCache
+{
+	int level;
+	string type;
+	long size;
+	int line_size;
+	int ways;
+	int sets;
+	string shared_cpus;
+};
+
+string Read_Sysfs(const string &path)
+{
+	ifstream in(path.c_str());
+	string value;
+	getline(in, value);
+	return value;
+}
+
+// "48K" / "2048K" / "8M" -> bytes
+long Parse_Size(const string &text)
+{
+	long value = atol(text.c_str());
+	if (text.find('K') != string::npos)
+		value <<= 10;
+	else if (text.find('M') != string::npos)
+		value <<= 20;
+	return value;
+}
+
+vector<SysfsCache> Read_Sysfs_Caches(int cpu)
+{
+	vector<SysfsCache> caches;
+	for (int index = 0;; index++)
+	{
+		string dir = "/sys/devices/system/cpu/cpu" + to_string(cpu) + "/cache/index" + to_string(index) + "/";
+		string level = Read_Sysfs(dir + "level");
+		if (level.empty())
+			break;
+		SysfsCache cache;
+		cache.level = atoi(level.c_str());
+		cache.type = Read_Sysfs(dir + "type");
+		cache.size = Parse_Size(Read_Sysfs(dir + "size"));
+		cache.line_size = atoi(Read_Sysfs(dir + "coherency_line_size").c_str());
+		cache.ways = atoi(Read_Sysfs(dir + "ways_of_associativity").c_str());
+		cache.sets = atoi(Read_Sysfs(dir + "number_of_sets").c_str());
+		cache.shared_cpus = Read_Sysfs(dir + "shared_cpu_list");
+		caches.push_back(cache);
+	}
+	return caches;
+}
+
+// the sysfs entry for a data (or unified) cache of the given level, or NULL
+const SysfsCache *Find_Sysfs_Cache(const vector<SysfsCache> &caches, int level)
+{
+	for (size_t i = 0; i < caches.size(); i++)
+		if (caches[i].level == level && caches[i].type != "Instruction")
+			return &caches[i];
+	return NULL;
+}
+
+/**************************************
+ * Pointer-chasing latency engine
+**************************************/
+volatile void *chase_sink; // keeps the final pointer of every chase alive
+
+// Link the addresses base + order[i] into one cycle: each address holds
+// the address visited after it. Returns the first address of the cycle.
+void **Link_Chase(BYTE *base, const vector<long> &order)
+{
+	for (size_t i = 0; i < order.size(); i++)
+		*(void **)(base + order[i]) = base + order[(i + 1) % order.size()];
+	return (void **)(base + order[0]);
+}
+
+// Sattolo's algorithm: a uniformly random permutation of 0..n-1 that forms
+// a single cycle, so the chase visits every slot before it repeats
+vector<long> Random_Cycle(long n, unsigned seed)
+{
+	vector<long> order(n);
+	for (long i = 0; i < n; i++)
+		order[i] = i;
+	srand(seed);
+	for (long i = n - 1; i > 0; i--)
+	{
+		long j = (((long)rand() << 16) ^ rand()) % i;
+		long t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	return order;
+}
+
+// Hardware miss counters read around the timed part of every chase where
+// the PMU is reachable (perf_event_paranoid permitting; most VMs have none)
+int miss_fds[2] = {-1, -1};		   // L1D read misses, last-level read misses
+double chase_misses[2] = {-1, -1}; // misses per load of the last chase, -1 if unknown
+
+void Open_Miss_Counters()
+{
+#ifdef __linux__
+	unsigned long long caches[2] = {PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_LL};
+	for (int i = 0; i < 2; i++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = caches[i] | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		miss_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+}
+
+void Count_Misses(bool start, long loads)
+{
+#ifdef __linux__
+	for (int i = 0; i < 2; i++)
+	{
+		if (miss_fds[i] < 0)
+			continue;
+		if (start)
+		{
+			ioctl(miss_fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(miss_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			continue;
+		}
+		ioctl(miss_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		long long count;
+		chase_misses[i] = read(miss_fds[i], &count, sizeof(count)) == sizeof(count) ? (double)count / loads : -1;
+	}
+#endif
+}
+
+// Follow the chain for `loads` dependent loads, after one untimed warm-up
+// pass of `warm` loads, and return the time per load in nanoseconds. Each
+// load needs the previous one's result, so neither the out-of-order core
+// nor the prefetcher can overlap them.
+double Chase_Ns(void **start, long warm, long loads)
+{
+	void **p = start;
+	for (long i = 0; i < warm; i++)
+		p = (void **)*p;
+	Count_Misses(true, loads);
+	double begin = Now_Ms();
+	for (long i = 0; i < loads; i += 8)
+	{
+		p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+		p = (void **)*p; p = (void **)*p; p = (void **)*p; p = (void **)*p;
+	}
+	double end = Now_Ms();
+	Count_Misses(false, loads);
+	chase_sink = p;
+	return (end - begin) * 1e6 / loads;
+}
+
+// enough loads for two passes over the cycle and at least 2^20 in total
+long Chase_Loads(long slots)
+{
+	long loads = 2 * slots;
+	return loads < (1 << 20) ? (1 << 20) : loads;
+}
+
+// ns/load of a random cycle through `footprint` bytes with one slot every `stride` bytes
+double Chase_Latency(long footprint, long stride, unsigned seed = 1)
+{
+	long slots = footprint / stride;
+	if (slots < 2)
+		slots = 2;
+	vector<long> order = Random_Cycle(slots, seed);
+	for (long i = 0; i < slots; i++)
+		order[i] *= stride;
+	return Chase_Ns(Link_Chase(test_array, order), slots, Chase_Loads(slots));
+}
+
+// ns/load of a chain over random `block`-byte blocks of `footprint` that
+// loads offset 0 and then `offset` of each block before moving on: while
+// offset is inside the same line the second load hits, so the knee in
+// this curve is the line size
+double Pair_Latency(long footprint, long block, long offset, unsigned seed = 2)
+{
+	long blocks = footprint / block;
+	vector<long> cycle = Random_Cycle(blocks, seed);
+	vector<long> order(2 * blocks);
+	for (long i = 0; i < blocks; i++)
+	{
+		order[2 * i] = cycle[i] * block;
+		order[2 * i + 1] = cycle[i] * block + offset;
+	}
+	return Chase_Ns(Link_Chase(test_array, order), 2 * blocks, Chase_Loads(2 * blocks));
+}
+
+// ns/load of `count` addresses `stride` bytes apart, visited in random
+// order; with stride a multiple of the set span they all share one set,
+// so the latency stays at the hit time while count <= ways
+double Set_Latency(int count, long stride, unsigned seed = 3)
+{
+	vector<long> order = Random_Cycle(count, seed);
+	for (int i = 0; i < count; i++)
+		order[i] *= stride;
+	return Chase_Ns(Link_Chase(test_array, order), count, 1 << 20);
+}
+
+/**************************************
+ * Measurement statistics
+**************************************/
+int trial_count = 5; // timed trials per measured point, see -n
+
+// one measured point: median of the trials left after outlier rejection
+// and a ~95% confidence interval of that median
+struct Stat
+{
+	double median;
+	double ci_lo, ci_hi;
+	int kept;	// trials left after outlier rejection
+	int total;	// trials run
+	double misses[2]; // median L1D / last-level misses per load, -1 if unknown
+};
+
+double Median(vector<double> v)
+{
+	sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Run `trial` trial_count times (the argument is the trial number, used as
+// the seed of the chase order so every trial walks a different but
+// reproducible cycle). Trials further than 3 scaled MADs from the median
+// are dropped as interference (interrupts, page faults, frequency changes);
+// the interval is the distribution-free order-statistic interval of the
+// median of what is left. Every trial ends in a chase, whose miss counts
+// are kept alongside.
+Stat Measure(const function<double(int)> &trial)
+{
+	vector<double> x, misses[2];
+	for (int t = 0; t < trial_count; t++)
+	{
+		x.push_back(trial(t + 1));
+		for (int i = 0; i < 2; i++)
+			misses[i].push_back(chase_misses[i]);
+	}
+	double med = Median(x);
+	vector<double> dev;
+	for (size_t i = 0; i < x.size(); i++)
+		dev.push_back(fabs(x[i] - med));
+	double mad = 1.4826 * Median(dev);
+	vector<double> kept;
+	for (size_t i = 0; i < x.size(); i++)
+		if (fabs(x[i] - med) <= 3 * mad)
+			kept.push_back(x[i]);
+	sort(kept.begin(), kept.end());
+
+	Stat s;
+	int n = (int)kept.size();
+	double h = 1.96 * sqrt((double)n) / 2;
+	int lo = (int)floor(n / 2.0 - h), hi = (int)ceil(n / 2.0 + h + 1);
+	s.median = Median(kept);
+	s.ci_lo = kept[max(lo, 1) - 1];
+	s.ci_hi = kept[min(hi, n) - 1];
+	s.kept = n;
+	s.total = (int)x.size();
+	for (int i = 0; i < 2; i++)
+		s.misses[i] = Median(misses[i]) < 0 ? -1 : Median(misses[i]);
+	return s;
+}
+
+ostream &operator<<(ostream &os, const Stat &s)
+{
+	os << s.median << ", [" << s.ci_lo << ", " << s.ci_hi << "], " << s.kept << "/" << s.total;
+	if (s.misses[0] >= 0)
+		os << ", L1D misses/load " << s.misses[0] << ", LLC misses/load " << s.misses[1];
+	return os;
+}
+
+vector<double> Medians(const vector<Stat> &stats)
+{
+	vector<double> m;
+	for (size_t i = 0; i < stats.size(); i++)
+		m.push_back(stats[i].median);
+	return m;
 }
 
-int Test_Cache_Size(int index, int *avg_time)
+/**************************************
+ * Change-point detection
+**************************************/
+// Split a curve into segments of constant level by binary segmentation on
+// log latency: a segment is cut where the cut removes the most squared
+// error, for as long as that gain beats a BIC penalty of 2 sigma^2 ln n.
+// sigma is the noise of the curve, estimated from the MAD of successive
+// differences (so the steps themselves do not inflate it) and never below
+// 2%. Working on the whole sweep at once means a single slow point cannot
+// pass for a step the way it can when only neighbours are compared.
+void Segment(const vector<double> &sum, const vector<double> &sq, int a, int b,
+			 double penalty, vector<int> &cuts)
 {
-	int size;
-	int data_size;
-	char data;
-	clock_t begin, end;
-	size = index;
-	for (int i = 0; i < 5; i++)
+	// squared error of y[i..j) around its mean, from prefix sums
+	auto sse = [&](int i, int j)
 	{
-		data_size = (1 << (size + 10));
-		Clear_L1_Cache();
-		Clear_L2_Cache();
-		begin = clock();
-		for (int j = 0; j < SIZE_TEST_TIMES; ++j)
+		double s = sum[j] - sum[i];
+		return sq[j] - sq[i] - s * s / (j - i);
+	};
+	int best = -1;
+	double gain = penalty;
+	for (int k = a + 1; k < b; k++)
+	{
+		double g = sse(a, b) - sse(a, k) - sse(k, b);
+		if (g > gain)
 		{
-			data = array[(rand() * rand()) % data_size];
+			gain = g;
+			best = k;
 		}
-		end = clock();
-		avg_time[i] = end - begin;
-		size++;
 	}
+	if (best < 0)
+		return;
+	Segment(sum, sq, a, best, penalty, cuts);
+	cuts.push_back(best);
+	Segment(sum, sq, best, b, penalty, cuts);
+}
 
-	int temp, process_time;
-	size = index;
-	int cache_size_result = (1 << size);
-	process_time = avg_time[1] - avg_time[0];
-	for (int i = 0; i < 5; i++)
+// start index of every segment, the first always being 0
+vector<int> Change_Points(const vector<double> &lat)
+{
+	int n = (int)lat.size();
+	vector<double> sum(n + 1, 0), sq(n + 1, 0), diff;
+	for (int i = 0; i < n; i++)
 	{
-		cout << "Test_Array_Size = " << (1 << size) << "KB, ";
-		cout << "Average access time = " << avg_time[i] << "ms" << endl;
-		if (i < 4)
+		double y = log(lat[i]);
+		sum[i + 1] = sum[i] + y;
+		sq[i + 1] = sq[i] + y * y;
+		if (i)
+			diff.push_back(fabs(y - log(lat[i - 1])));
+	}
+	double sigma = diff.empty() ? 0 : 1.4826 * Median(diff) / sqrt(2.0);
+	sigma = max(sigma, 0.02);
+	vector<int> cuts(1, 0);
+	Segment(sum, sq, 0, n, 2 * sigma * sigma * log((double)n), cuts);
+	return cuts;
+}
+
+// A knee is a step between two plateaus of the segmented curve whose
+// levels differ by more than `rise`. Neighbouring segments closer than
+// sqrt(rise) are first merged into one; what is then shorter than MIN_PLATEAU
+// points or not flat (a ramp cut into short steps, or stray points) is a
+// transition between plateaus and only counts at the end of the curve.
+#define MIN_PLATEAU 3
+
+struct Knee
+{
+	int index;		// first point past the plateau that is above it by `rise`
+	double before;	// plateau latency before the knee
+	double after;	// plateau latency after it
+};
+
+double Level(const vector<double> &lat, int a, int b)
+{
+	return Median(vector<double>(lat.begin() + a, lat.begin() + b));
+}
+
+// the middle half of lat[a, b) lies within a factor sqrt(rise)
+bool Flat(const vector<double> &lat, int a, int b, double rise)
+{
+	vector<double> v(lat.begin() + a, lat.begin() + b);
+	sort(v.begin(), v.end());
+	return v[(3 * v.size() - 1) / 4] <= v[v.size() / 4] * sqrt(rise);
+}
+
+vector<Knee> Find_Knees(const vector<double> &lat, double rise)
+{
+	int n = (int)lat.size();
+	vector<int> cuts = Change_Points(lat), runs;
+	cuts.push_back(n);
+	for (size_t s = 0; s + 1 < cuts.size(); s++)
+	{
+		if (!runs.empty())
+		{
+			double prev = Level(lat, runs.back(), cuts[s]);
+			double level = Level(lat, cuts[s], cuts[s + 1]);
+			if (level < prev * sqrt(rise) && level > prev / sqrt(rise))
+				continue;
+		}
+		runs.push_back(cuts[s]);
+	}
+	runs.push_back(n);
+
+	vector<Knee> knees;
+	int plateau_end = -1;
+	double plateau = 0;
+	for (size_t r = 0; r + 1 < runs.size(); r++)
+	{
+		int a = runs[r], b = runs[r + 1];
+		if ((b - a < MIN_PLATEAU || !Flat(lat, a, b, rise)) && b != n)
+			continue;
+		double level = Level(lat, a, b);
+		if (plateau_end >= 0 && level > plateau * rise)
+		{
+			Knee knee;
+			knee.index = plateau_end;
+			while (lat[knee.index] <= plateau * rise)
+				knee.index++;
+			knee.before = plateau;
+			knee.after = level;
+			knees.push_back(knee);
+		}
+		else if (plateau_end >= 0 && level > plateau / rise)
 		{
-			temp = avg_time[i + 1] - avg_time[i];
-			if (temp > process_time)
-			{
-				cache_size_result = (1 << size);
-				process_time = temp;
-			}
+			plateau_end = b; // same plateau, interrupted by stray points
+			continue;
 		}
-		size++;
+		plateau = level;
+		plateau_end = b;
 	}
-	return cache_size_result;
+	return knees;
 }
 
-int Test_Cache_Block(int index, int *avg_time)
+long Round_Up_Pow2(long value)
 {
+	long p = 1;
+	while (p < value)
+		p <<= 1;
+	return p;
+}
+
+// one measured cache level
+struct CacheLevel
+{
+	long size;			// capacity in bytes, 0 if not found
+	int block;			// line size in bytes, 0 if not measured
+	int ways;			// associativity, 0 if not measured
+	double latency_ns;	// load-to-use latency of a hit in this level
+	double latency_lo;	// confidence interval of latency_ns
+	double latency_hi;
+};
+vector<CacheLevel> levels;
+double memory_latency_ns = 0; // plateau after the last knee of the size sweep
+
+// the size sweep, kept for the topology file
+vector<long> sweep_footprints;
+vector<Stat> sweep_stats;
+
+// Chase footprints from 4KB to the whole test array in quarter-octave steps
+// and turn every knee into a cache level. The capacity is the footprint at
+// which the latency is halfway between the two plateaus, i.e. about half of
+// the loads still hit; it is refined by bisection between sweep points.
+void Test_Cache_Size()
+{
+	cout << "Cache_Size_Test (footprint, ns/load, 95% CI, trials kept)" << endl;
+	vector<long> &footprints = sweep_footprints;
+	vector<Stat> &stats = sweep_stats;
+	for (int q = 0;; q++)
+	{
+		long footprint = (long)((4 << 10) * pow(2.0, q / 4.0)) / 64 * 64;
+		if (footprint > ARRAY_SIZE)
+			break;
+		footprints.push_back(footprint);
+		stats.push_back(Measure([&](int seed) { return Chase_Latency(footprint, 64, seed); }));
+		cout << footprint << ", " << stats.back() << endl;
+	}
+	vector<double> lat = Medians(stats);
 
-	int size;
-	int data_size;
-	char data;
-	clock_t begin, end;
-	unsigned int temp;
-	temp = index;
-	for (int i = 0; i < 8; ++i)
+	vector<Knee> knees = Find_Knees(lat, 1.5);
+	if (!knees.empty())
+		memory_latency_ns = knees.back().after;
+	for (size_t k = 0; k < knees.size(); k++)
 	{
-		begin = clock();
-		for (int j = 0; j < temp; ++j)
+		double half = (knees[k].before + knees[k].after) / 2;
+		size_t i = knees[k].index;
+		while (i + 1 < lat.size() && lat[i] < half)
+			i++;
+		long lo = footprints[i - 1], hi = footprints[i];
+		while (hi - lo > 1024)
 		{
-			for (int k = 0; k < ARRAY_SIZE; k += temp)
-			{
-				data += array[k];
-			}
+			long mid = (lo + hi) / 2 / 64 * 64;
+			if (Measure([&](int seed) { return Chase_Latency(mid, 64, seed); }).median >= half)
+				hi = mid;
+			else
+				lo = mid;
 		}
-		end = clock();
-		avg_time[i] = end - begin;
-		temp = temp << 1;
+		// the interval of the hit latency is that of the point closest to
+		// the plateau median
+		size_t p = 0;
+		for (size_t j = 1; j < (size_t)knees[k].index; j++)
+			if (fabs(lat[j] - knees[k].before) < fabs(lat[p] - knees[k].before))
+				p = j;
+		CacheLevel level;
+		level.size = (lo + 512) / 1024 * 1024;
+		level.block = 0;
+		level.ways = 0;
+		level.latency_ns = knees[k].before;
+		level.latency_lo = stats[p].ci_lo;
+		level.latency_hi = stats[p].ci_hi;
+		levels.push_back(level);
+		cout << "L" << k + 1 << "_Cache_Size is " << level.size / 1024 << "KB, hit latency "
+			 << level.latency_ns << "ns [" << level.latency_lo << ", " << level.latency_hi << "]" << endl;
+	}
+}
+
+// Sweep the second load's offset from 8B to 512B over a footprint four
+// times the cache; the first knee is where it leaves the first load's line.
+int Test_Cache_Block(int level)
+{
+	cout << "L" << level + 1 << "_Cache_Block_Test (offset, ns/load, 95% CI, trials kept)" << endl;
+	long footprint = 4 * levels[level].size;
+	if (footprint > ARRAY_SIZE)
+		footprint = ARRAY_SIZE;
+	vector<Stat> stats;
+	vector<int> offsets;
+	for (int offset = 8; offset <= 512; offset <<= 1)
+	{
+		offsets.push_back(offset);
+		stats.push_back(Measure([&](int seed) { return Pair_Latency(footprint, 1024, offset, seed); }));
+		cout << offset << ", " << stats.back() << endl;
+	}
+	vector<double> lat = Medians(stats);
+	vector<Knee> knees = Find_Knees(lat, 1.3);
+	if (!knees.empty())
+	{
+		cout << "L" << level + 1 << "_Block_Size is " << offsets[knees[0].index] << "B" << endl;
+		return offsets[knees[0].index];
+	}
+	// no step passed the knee test; name the largest one as a hint only
+	size_t step = 1;
+	for (size_t i = 2; i < lat.size(); i++)
+		if (lat[i] / lat[i - 1] > lat[step] / lat[step - 1])
+			step = i;
+	cout << "L" << level + 1 << "_Block_Size not found (largest step " << lat[step] / lat[step - 1]
+		 << "x at " << offsets[step] << "B)" << endl;
+	return 0;
+}
+
+// Chase 1..40 addresses that map to one set of the cache. Every smaller
+// cache is cut by the same stride, so level n's associativity is read
+// from the n-th knee (or the last one found).
+int Test_Cache_Way_Count(int level)
+{
+	cout << "L" << level + 1 << "_Cache_Way_Count (addresses, ns/load, 95% CI, trials kept)" << endl;
+	long stride = Round_Up_Pow2(levels[level].size);
+	int max_count = 40;
+	if (stride * max_count > ARRAY_SIZE)
+		max_count = (int)(ARRAY_SIZE / stride);
+	vector<Stat> stats;
+	for (int count = 1; count <= max_count; count++)
+	{
+		stats.push_back(Measure([&](int seed) { return Set_Latency(count, stride, seed); }));
+		cout << count << ", " << stats.back() << endl;
+	}
+	vector<Knee> knees = Find_Knees(Medians(stats), 1.2);
+	int result = 0;
+	if (!knees.empty())
+		result = knees[(size_t)level < knees.size() ? level : knees.size() - 1].index;
+	cout << "L" << level + 1 << "_Way_Count is " << result << endl;
+	return result;
+}
+
+/**************************************
+ * TLB reach and page walks
+**************************************/
+#define TLB_SPAN (1L << 30)		// bytes reserved for every page size
+#define TLB_MAX_PAGES 16384		// 4KB pages in the longest sweep (64MB)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// TLB_SPAN bytes backed by one page size; base is NULL if the system
+// cannot provide it
+struct PageBuffer
+{
+	string name;	// "4KB", "2MB-hugetlbfs", "2MB-thp", "1GB-hugetlbfs"
+	long page;		// page size in bytes
+	BYTE *base;
+};
+
+// bytes of the mapping holding p that are backed by transparent huge
+// pages, from /proc/self/smaps; -1 if unknown
+long Thp_Bytes(const void *p)
+{
+	ifstream in("/proc/self/smaps");
+	string line;
+	bool inside = false;
+	while (getline(in, line))
+	{
+		unsigned long lo, hi;
+		if (sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2 && line.find(':') > line.find(' '))
+			inside = (unsigned long)p >= lo && (unsigned long)p < hi;
+		else if (inside && line.compare(0, 14, "AnonHugePages:") == 0)
+			return atol(line.c_str() + 14) << 10;
 	}
+	return -1;
+}
 
-	temp = index;
-	int process_time = avg_time[1] - avg_time[0], temp_time;
-	int cache_block_result;
-	for (int i = 0; i < 8; ++i)
+// 4KB pages are asked for explicitly (THP may be "always"); 2MB pages come
+// from hugetlbfs or else THP; 1GB pages only exist in hugetlbfs
+PageBuffer Alloc_Pages(long page)
+{
+	PageBuffer buf;
+	buf.page = page;
+	buf.base = NULL;
+#ifdef __linux__
+	int shift = page == 4096 ? 0 : page == HUGE_PAGE_SIZE ? 21 : 30;
+	void *p = MAP_FAILED;
+	if (shift)
+		p = mmap(NULL, TLB_SPAN, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+	if (p != MAP_FAILED)
 	{
-		cout << "Block_Size = " << temp << " B, ";
-		cout << "Average access time = " << avg_time[i] << "ms " << endl;
-		if (i < 7)
+		buf.name = page == HUGE_PAGE_SIZE ? "2MB-hugetlbfs" : "1GB-hugetlbfs";
+		buf.base = (BYTE *)p;
+	}
+	else if (page == 4096)
+	{
+		p = mmap(NULL, TLB_SPAN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			madvise(p, TLB_SPAN, MADV_NOHUGEPAGE);
+			buf.name = "4KB";
+			buf.base = (BYTE *)p;
+		}
+	}
+	else if (page == HUGE_PAGE_SIZE && posix_memalign(&p, HUGE_PAGE_SIZE, TLB_SPAN) == 0)
+	{
+		if (madvise(p, TLB_SPAN, MADV_HUGEPAGE) == 0)
 		{
-			temp_time = avg_time[i + 1] - avg_time[i];
-			if (temp_time > process_time)
-			{
-				cache_block_result = (1 << size);
-				process_time = temp_time;
-			}
+			buf.name = "2MB-thp";
+			buf.base = (BYTE *)p;
 		}
-		size++;
-		temp = temp << 1;
+		else
+			free(p);
+	}
+#else
+	if (page == 4096)
+	{
+		buf.name = "4KB";
+		buf.base = (BYTE *)malloc(TLB_SPAN);
+	}
+#endif
+	return buf;
+}
+
+// give back what Alloc_Pages mapped; THP buffers came from posix_memalign
+void Free_Pages(PageBuffer &buf)
+{
+	if (buf.base == NULL)
+		return;
+#ifdef __linux__
+	if (buf.name == "2MB-thp")
+		free(buf.base);
+	else
+		munmap(buf.base, TLB_SPAN);
+#else
+	free(buf.base);
+#endif
+	buf.base = NULL;
+}
+
+// ns/load of a random cycle over `count` addresses `stride` bytes apart.
+// Address i is moved on by i + i/32 lines inside its stride so that
+// page-strided addresses spread evenly over the L1 sets, and, on a
+// physically contiguous huge page, also over the first 2048 L2 sets
+// (a plain i-th line would repeat the L2 set every 64 pages).
+double Strided_Latency(BYTE *base, long count, long stride, unsigned seed)
+{
+	vector<long> order = Random_Cycle(count, seed);
+	for (long i = 0; i < count; i++)
+		order[i] = order[i] * stride + (order[i] + order[i] / 32) * 64 % stride;
+	return Chase_Ns(Link_Chase(base, order), count, Chase_Loads(count));
+}
+
+// Quarter-octave page counts from 4 to `max_pages`
+vector<long> Page_Counts(long max_pages)
+{
+	vector<long> counts;
+	for (int q = 0;; q++)
+	{
+		long count = (long)(4 * pow(2.0, q / 4.0));
+		if (count > max_pages)
+			break;
+		if (counts.empty() || count != counts.back())
+			counts.push_back(count);
+	}
+	return counts;
+}
+
+// Bisect between two page counts for the last one whose latency stays
+// under `threshold`: the number of entries of the TLB level
+long Tlb_Entries(const function<double(long)> &latency, long lo, long hi, double threshold)
+{
+	while (hi - lo > 1)
+	{
+		long mid = (lo + hi) / 2;
+		if (latency(mid) >= threshold)
+			hi = mid;
+		else
+			lo = mid;
 	}
-	return cache_block_result;
+	return lo;
 }
 
-int Test_Cache_Way_Count(int array_size, int index, int *avg_time)
+// Chase one line per 4KB page over a growing number of pages, once on 4KB
+// pages and once on the same addresses backed by 2MB pages, where the whole
+// sweep needs at most TLB_MAX_PAGES/512 TLB entries. The 2MB run has the
+// same cache behaviour, so the difference between the two is what the TLB
+// costs: a plateau while the pages fit the first-level DTLB, a small step
+// while they fit the second-level STLB, then the page-walk cost. The
+// 2MB-stride sweep does the same for the 2MB DTLB, and the last table
+// shows what huge pages buy a random 64B-stride chase over 64MB.
+void Test_Tlb()
 {
-	int temp;
-	int array_jump;
-	char data;
-	clock_t begin, end, temp_time;
-	int process_time, way_count_result;
-	temp = index;
-	for (int i = 0; i < 5; ++i)
+	PageBuffer small = Alloc_Pages(4096), huge = Alloc_Pages(HUGE_PAGE_SIZE),
+			   giant = Alloc_Pages(1L << 30);
+	if (small.base == NULL)
 	{
-		array_jump = array_size / temp;
-		begin = clock();
-		for (int j = 0; j < WAY_TEST_TIMES; ++j)
+		cerr << "cannot allocate the 4KB-page buffer" << endl;
+		Free_Pages(huge);
+		Free_Pages(giant);
+		return;
+	}
+	cout << "TLB test buffers: " << small.name << ", " << (huge.base ? huge.name : "2MB unavailable")
+		 << ", " << (giant.base ? giant.name : "1GB unavailable") << endl;
+
+	auto lat = [&](const PageBuffer &buf, long count, long stride)
+	{
+		return Measure([&](int seed) { return Strided_Latency(buf.base, count, stride, seed); }).median;
+	};
+	// latency on 4KB pages minus what the same chase costs without TLB
+	// misses, on top of the L1 hit time so that it stays a latency curve
+	double hit = huge.base ? lat(huge, 4, 4096) : 0;
+	auto tlb_only = [&](long count)
+	{
+		return huge.base ? lat(small, count, 4096) - lat(huge, count, 4096) + hit : lat(small, count, 4096);
+	};
+
+	cout << "# tlb_4KB: pages,reach_bytes,4KB ns/load,2MB ns/load,tlb_only ns/load" << endl;
+	vector<long> counts = Page_Counts(TLB_MAX_PAGES);
+	vector<double> extra;
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		double s = lat(small, counts[i], 4096), h = huge.base ? lat(huge, counts[i], 4096) : 0;
+		extra.push_back(huge.base ? s - h + hit : s);
+		cout << counts[i] << "," << counts[i] * 4096 << "," << s << "," << h << "," << extra.back() << endl;
+	}
+	vector<Knee> knees = Find_Knees(extra, 1.2);
+	const char *names[] = {"DTLB_4KB", "STLB_4KB"};
+	const char *misses[] = {"STLB_Hit_Latency", "Page_Walk_Latency"};
+	for (size_t k = 0; k < knees.size() && k < 2; k++)
+	{
+		long entries = Tlb_Entries(tlb_only, counts[knees[k].index - 1], counts[knees[k].index],
+								   (knees[k].before + knees[k].after) / 2);
+		cout << names[k] << "_Entries is " << entries << " (reach " << entries * 4 << "KB)" << endl;
+		cout << misses[k] << " is " << knees[k].after - knees[0].before << "ns" << endl;
+	}
+
+	if (huge.base)
+	{
+		cout << "# tlb_2MB: pages,reach_bytes,ns/load" << endl;
+		vector<long> huge_counts = Page_Counts(TLB_SPAN / HUGE_PAGE_SIZE);
+		vector<double> huge_lat;
+		for (size_t i = 0; i < huge_counts.size(); i++)
+		{
+			huge_lat.push_back(lat(huge, huge_counts[i], HUGE_PAGE_SIZE));
+			cout << huge_counts[i] << "," << huge_counts[i] * HUGE_PAGE_SIZE << "," << huge_lat.back() << endl;
+		}
+		vector<Knee> huge_knees = Find_Knees(huge_lat, 1.2);
+		if (!huge_knees.empty())
+		{
+			long entries = Tlb_Entries([&](long count) { return lat(huge, count, HUGE_PAGE_SIZE); },
+									   huge_counts[huge_knees[0].index - 1], huge_counts[huge_knees[0].index],
+									   (huge_knees[0].before + huge_knees[0].after) / 2);
+			cout << "DTLB_2MB_Entries is " << entries << " (reach " << entries * 2 << "MB)" << endl;
+		}
+		long thp = Thp_Bytes(huge.base);
+		if (huge.name == "2MB-thp" && thp >= 0)
+			cout << "THP backing " << thp / HUGE_PAGE_SIZE << " of the touched 2MB pages" << endl;
+	}
+
+	cout << "# huge_page_impact: backing,random 64B chase over 64MB ns/load,speedup over 4KB" << endl;
+	long slots = (TLB_MAX_PAGES * 4096L) / 64;
+	double base = lat(small, slots, 64);
+	cout << small.name << "," << base << ",1" << endl;
+	const PageBuffer *bigger[] = {&huge, &giant};
+	for (int b = 0; b < 2; b++)
+		if (bigger[b]->base)
 		{
-			for (int k = 0; k < temp; k += 2)
-			{
-				memset(&array[k * array_jump], 0, array_jump);
-			}
+			double l = lat(*bigger[b], slots, 64);
+			cout << bigger[b]->name << "," << l << "," << base / l << endl;
 		}
-		end = clock();
-		avg_time[i] = end - begin;
-		temp = temp << 1;
+	Free_Pages(small);
+	Free_Pages(huge);
+	Free_Pages(giant);
+}
+
+/**************************************
+ * Bandwidth and prefetcher suite
+**************************************/
+#define STREAM_SCALAR 3.0
+
+// Allocate a page-aligned buffer from the calling thread and touch it, so
+// it is backed by (huge) pages on that thread's NUMA node
+double *Alloc_Touched(long bytes)
+{
+	void *p = NULL;
+	if (posix_memalign(&p, HUGE_PAGE_SIZE, bytes) != 0)
+		return NULL;
+#ifdef __linux__
+	madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+	memset(p, 0, bytes);
+	return (double *)p;
+}
+
+// STREAM kernels: copy c = a, scale b = s*c, add c = a+b, triad a = b+s*c
+void Copy_Scalar(double *a, double *b, double *c, long n) { for (long i = 0; i < n; i++) c[i] = a[i]; }
+void Scale_Scalar(double *a, double *b, double *c, long n) { for (long i = 0; i < n; i++) b[i] = STREAM_SCALAR * c[i]; }
+void Add_Scalar(double *a, double *b, double *c, long n) { for (long i = 0; i < n; i++) c[i] = a[i] + b[i]; }
+void Triad_Scalar(double *a, double *b, double *c, long n) { for (long i = 0; i < n; i++) a[i] = b[i] + STREAM_SCALAR * c[i]; }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STREAM_X86_SIMD
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// explicit 256-bit kernels; NT selects non-temporal stores, which write
+// around the caches and skip the read-for-ownership of the destination
+template <bool NT>
+AVX2_TARGET inline void Store_Pd(double *p, __m256d v)
+{
+	if (NT)
+		_mm256_stream_pd(p, v);
+	else
+		_mm256_store_pd(p, v);
+}
+
+template <bool NT>
+AVX2_TARGET void Copy_Avx2(double *a, double *b, double *c, long n)
+{
+	for (long i = 0; i < n; i += 4)
+		Store_Pd<NT>(c + i, _mm256_load_pd(a + i));
+	_mm_sfence();
+}
+
+template <bool NT>
+AVX2_TARGET void Scale_Avx2(double *a, double *b, double *c, long n)
+{
+	__m256d s = _mm256_set1_pd(STREAM_SCALAR);
+	for (long i = 0; i < n; i += 4)
+		Store_Pd<NT>(b + i, _mm256_mul_pd(s, _mm256_load_pd(c + i)));
+	_mm_sfence();
+}
+
+template <bool NT>
+AVX2_TARGET void Add_Avx2(double *a, double *b, double *c, long n)
+{
+	for (long i = 0; i < n; i += 4)
+		Store_Pd<NT>(c + i, _mm256_add_pd(_mm256_load_pd(a + i), _mm256_load_pd(b + i)));
+	_mm_sfence();
+}
+
+template <bool NT>
+AVX2_TARGET void Triad_Avx2(double *a, double *b, double *c, long n)
+{
+	__m256d s = _mm256_set1_pd(STREAM_SCALAR);
+	for (long i = 0; i < n; i += 4)
+		Store_Pd<NT>(a + i, _mm256_add_pd(_mm256_load_pd(b + i), _mm256_mul_pd(s, _mm256_load_pd(c + i))));
+	_mm_sfence();
+}
+#endif
+
+struct StreamKernel
+{
+	const char *name;
+	const char *variant;
+	int arrays;	// arrays moved per element, as counted by STREAM
+	void (*run)(double *, double *, double *, long);
+};
+
+vector<StreamKernel> Stream_Kernels()
+{
+	StreamKernel scalar[] = {
+		{ "copy", "scalar", 2, Copy_Scalar }, { "scale", "scalar", 2, Scale_Scalar },
+		{ "add", "scalar", 3, Add_Scalar }, { "triad", "scalar", 3, Triad_Scalar } };
+	vector<StreamKernel> kernels(scalar, scalar + 4);
+#ifdef STREAM_X86_SIMD
+	if (__builtin_cpu_supports("avx2"))
+	{
+		StreamKernel simd[] = {
+			{ "copy", "avx2", 2, Copy_Avx2<false> }, { "scale", "avx2", 2, Scale_Avx2<false> },
+			{ "add", "avx2", 3, Add_Avx2<false> }, { "triad", "avx2", 3, Triad_Avx2<false> },
+			{ "copy", "avx2-nt", 2, Copy_Avx2<true> }, { "scale", "avx2-nt", 2, Scale_Avx2<true> },
+			{ "add", "avx2-nt", 3, Add_Avx2<true> }, { "triad", "avx2-nt", 3, Triad_Avx2<true> } };
+		kernels.insert(kernels.end(), simd, simd + 8);
 	}
+#endif
+	return kernels;
+}
 
-	temp = index;
-	process_time = avg_time[1] - avg_time[0];
-	way_count_result = temp / 2;
-	for (int i = 0; i < 5; ++i)
+// Start `threads` threads pinned to consecutive CPUs after `cpu`. Each runs
+// setup(t) untimed, waits for the others, then runs work(t). Returns the
+// wall time in ms from the common start until the last thread finishes.
+double Run_Threads(int cpu, int threads, const function<void(int)> &setup, const function<void(int)> &work)
+{
+	long cpus = thread::hardware_concurrency();
+	atomic<int> ready(0);
+	atomic<bool> go(false);
+	vector<double> finish(threads);
+	vector<thread> pool;
+	for (int t = 0; t < threads; t++)
+		pool.push_back(thread([&, t] {
+			Pin_To_Cpu((int)((cpu + t) % (cpus > 0 ? cpus : 1)));
+			setup(t);
+			ready++;
+			while (!go)
+				;
+			work(t);
+			finish[t] = Now_Ms();
+		}));
+	while (ready < threads)
+		this_thread::yield();
+	double start = Now_Ms();
+	go = true;
+	for (int t = 0; t < threads; t++)
+		pool[t].join();
+	Pin_To_Cpu(cpu);
+	return *max_element(finish.begin(), finish.end()) - start;
+}
+
+// GB/s of one kernel with every thread streaming over its own `working_set`
+// bytes, split into three arrays; best of three trials of ~256MB per thread
+double Stream_Bandwidth(int cpu, int threads, const StreamKernel &kern, long working_set)
+{
+	long n = working_set / 3 / sizeof(double) / 8 * 8;
+	if (n < 8)
+		n = 8;
+	long bytes = kern.arrays * n * (long)sizeof(double);
+	long reps = (256L << 20) / bytes + 1;
+	vector<double *> buf(threads);
+	double best = 0;
+	for (int trial = 0; trial < 3; trial++)
 	{
-		cout << "Way_Count = " << temp / 2 << ", ";
-		cout << "Average access time = " << avg_time[i] << "ms " << endl;
-		if (i < 4)
+		double ms = Run_Threads(cpu, threads,
+			[&](int t) { buf[t] = Alloc_Touched(3 * n * sizeof(double)); },
+			[&](int t) {
+				for (long r = 0; r < reps; r++)
+					kern.run(buf[t], buf[t] + n, buf[t] + 2 * n, n);
+			});
+		for (int t = 0; t < threads; t++)
+			free(buf[t]);
+		double gbs = (double)threads * reps * bytes / (ms * 1e6);
+		if (gbs > best)
+			best = gbs;
+	}
+	return best;
+}
+
+// Independent reads of one 8-byte word per touched line over the test
+// array: sequential lines, fixed strides and LCG-random lines. Returns ns
+// per line; the prefetcher's help shows as the gap to the random pattern.
+double Read_Pattern_Ns(long stride, bool random)
+{
+	long lines = ARRAY_SIZE / stride;
+	const double *p = (const double *)test_array;
+	long step = stride / sizeof(double);
+	double sum = 0;
+	double begin = Now_Ms();
+	if (random)
+	{
+		unsigned long mask = ARRAY_SIZE / 64 - 1, idx = 1;
+		for (long i = 0; i < lines; i++)
 		{
-			temp_time = avg_time[i + 1] - avg_time[i];
-			if (temp_time > process_time)
-			{
-				way_count_result = temp / 2;
-				process_time = temp_time;
-			}
+			idx = (idx * 1664525 + 1013904223) & mask;
+			sum += p[idx * 8];
 		}
-		temp = temp << 1;
 	}
-	return way_count_result;
+	else
+	{
+		for (long i = 0; i < lines; i++)
+			sum += p[i * step];
+	}
+	double end = Now_Ms();
+	chase_sink = (void *)(long)sum;
+	return (end - begin) * 1e6 / lines;
 }
 
-int L1_DCache_Size()
+// Bandwidth per level and thread count, read patterns, and the latency of
+// a dependent chase through memory while 0..threads-1 other threads stream
+void Test_Bandwidth(int cpu, int max_threads)
 {
-	cout << "L1_Data_Cache_Test" << endl;
-	int avg_time[5];
-	int index = 3;
-	int result;
-	result = Test_Cache_Size(index, avg_time);
-	cout << "L1_Data_Cache_Size is " << result << "KB" << endl;
-	return result << 10;
+	vector<StreamKernel> kernels = Stream_Kernels();
+	vector<long> sets;
+	vector<string> names;
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		sets.push_back(levels[i].size / 2);
+		names.push_back("L" + to_string(i + 1));
+	}
+	long mem = levels.empty() ? (64L << 20) : 4 * levels.back().size;
+	sets.push_back(mem < (64L << 20) ? (64L << 20) : mem);
+	names.push_back("mem");
+
+	cout << "# stream: level,working_set,threads,kernel,variant,GB/s" << endl;
+	for (size_t l = 0; l < sets.size(); l++)
+		for (int t = 1; t <= max_threads; t++)
+			for (size_t k = 0; k < kernels.size(); k++)
+				cout << names[l] << "," << sets[l] << "," << t << "," << kernels[k].name << ","
+					 << kernels[k].variant << "," << Stream_Bandwidth(cpu, t, kernels[k], sets[l]) << endl;
+
+	cout << "# prefetch: pattern,stride,ns/line,GB/s" << endl;
+	long strides[] = { 64, 128, 256, 512, 1024, 4096 };
+	for (int s = 0; s < 6; s++)
+	{
+		double ns = Read_Pattern_Ns(strides[s], false);
+		cout << (s ? "strided" : "sequential") << "," << strides[s] << "," << ns << "," << 64 / ns << endl;
+	}
+	double ns = Read_Pattern_Ns(64, true);
+	cout << "random,64," << ns << "," << 64 / ns << endl;
+
+	cout << "# loaded_latency: loaders,ns/load" << endl;
+	StreamKernel triad = kernels[3];
+	long n = sets.back() / 3 / sizeof(double) / 8 * 8;
+	for (int loaders = 0; loaders < max_threads; loaders++)
+	{
+		atomic<bool> stop(false);
+		double latency = 0;
+		vector<double *> buf(loaders + 1);
+		Run_Threads(cpu, loaders + 1,
+			[&](int t) {
+				if (t > 0)
+					buf[t] = Alloc_Touched(3 * n * sizeof(double));
+			},
+			[&](int t) {
+				if (t == 0)
+				{
+					latency = Chase_Latency(ARRAY_SIZE, 64);
+					stop = true;
+					return;
+				}
+				while (!stop)
+					triad.run(buf[t], buf[t] + n, buf[t] + 2 * n, n);
+			});
+		for (int t = 1; t <= loaders; t++)
+			free(buf[t]);
+		cout << loaders << "," << latency << endl;
+	}
 }
 
-int L2_Cache_Size()
+// true when a measured value is within 10% of the kernel's
+bool Agrees(double measured, double sysfs)
 {
-	cout << "L2_Data_Cache_Test" << endl;
-	int avg_time[5];
-	int index = 6;
-	int result;
-	result = Test_Cache_Size(index, avg_time);
-	cout << "L2_Cache_Size is " << result << "KB" << endl;
-	return result << 10;
+	return measured >= sysfs * 0.9 && measured <= sysfs * 1.1;
 }
 
-int L1_DCache_Block()
+// a measured value for the JSON output, null when it was not found
+string Json_Measured(int value)
 {
-	cout << "L1_DCache_Block_Test" << endl;
-	int index = 1;
-	int avg_time[8];
-	int result;
-	result = Test_Cache_Block(index, avg_time);
-	cout << "L1_Data_Block_Size is " << result << "B" << endl;
-	return result;
+	return value ? to_string(value) : "null";
 }
 
-int L2_Cache_Block()
+// whether a measurement matches the kernel's value, null if not measured
+string Json_Agrees(int measured, int sysfs)
 {
-	cout << "L2_Cache_Block_Test" << endl;
-	int index = 1;
-	int avg_time[8];
-	int result;
-	result = Test_Cache_Block(index, avg_time);
-	cout << "L2_Block_Size is " << result << "B" << endl;
-	return result;
+	return !measured ? "null" : measured == sysfs ? "true" : "false";
 }
 
-int L1_DCache_Way_Count()
+// one measured cache level next to what the kernel reports for it
+void Write_Level(ostream &os, int level, const CacheLevel &m, const SysfsCache *sys)
 {
-	cout << "L1_DCache_Way_Count" << endl;
-	int array_size = L1_cache_size << 1;
-	int index = 2;
-	int avg_time[5];
-	int result;
-	result = Test_Cache_Way_Count(array_size, index, avg_time);
-	cout << "L1_DCache_Way_Count is " << result << endl;
+	os << "    { \"level\": " << level << ", \"measured\": { \"size\": " << m.size
+	   << ", \"line_size\": " << Json_Measured(m.block) << ", \"ways\": " << Json_Measured(m.ways)
+	   << ", \"latency_ns\": " << m.latency_ns << ", \"latency_ci_ns\": [" << m.latency_lo
+	   << ", " << m.latency_hi << "] }";
+	if (sys)
+	{
+		os << ", \"sysfs\": { \"type\": \"" << sys->type << "\", \"size\": " << sys->size
+		   << ", \"line_size\": " << sys->line_size << ", \"ways\": " << sys->ways
+		   << ", \"sets\": " << sys->sets << ", \"shared_cpu_list\": \"" << sys->shared_cpus << "\" }"
+		   << ", \"agree\": { \"size\": " << (Agrees(m.size, sys->size) ? "true" : "false")
+		   << ", \"line_size\": " << Json_Agrees(m.block, sys->line_size)
+		   << ", \"ways\": " << Json_Agrees(m.ways, sys->ways) << " }";
+	}
+	os << " }";
 }
 
-int L2_Cache_Way_Count()
+// Machine-readable topology: the measured parameters of every level found,
+// the sysfs description of every cache of the CPU, and how the two compare.
+void Write_Topology(ostream &os, int cpu, const vector<SysfsCache> &caches)
 {
-	cout << "L2_Cache_Way_Count" << endl;
-	int array_size = L2_cache_size << 1;
-	int index = 2;
-	int avg_time[5];
-	int result;
-	result = Test_Cache_Way_Count(array_size, index, avg_time);
-	cout << "L2_Way_Count is " << result << endl;
+	os << "{" << endl;
+	os << "  \"cpu\": " << cpu << "," << endl;
+	os << "  \"timer\": \"clock_gettime(CLOCK_MONOTONIC_RAW)\"," << endl;
+	os << "  \"test_array_pages\": \"" << array_pages << "\"," << endl;
+	os << "  \"trials_per_point\": " << trial_count << "," << endl;
+	os << "  \"levels\": [";
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		os << (i ? "," : "") << endl;
+		Write_Level(os, (int)i + 1, levels[i], Find_Sysfs_Cache(caches, (int)i + 1));
+	}
+	os << endl << "  ]," << endl;
+	os << "  \"memory_latency_ns\": " << memory_latency_ns << "," << endl;
+	// the chase behind the levels, for comparing a cache model against it;
+	// misses per load come from the PMU and are null without one
+	os << "  \"size_sweep\": [";
+	for (size_t i = 0; i < sweep_stats.size(); i++)
+	{
+		const Stat &st = sweep_stats[i];
+		os << (i ? "," : "") << endl
+		   << "    { \"footprint\": " << sweep_footprints[i] << ", \"stride\": 64, \"latency_ns\": " << st.median
+		   << ", \"latency_ci_ns\": [" << st.ci_lo << ", " << st.ci_hi << "]";
+		const char *names[] = {"l1d_misses_per_load", "llc_misses_per_load"};
+		for (int m = 0; m < 2; m++)
+		{
+			os << ", \"" << names[m] << "\": ";
+			if (st.misses[m] >= 0)
+				os << st.misses[m];
+			else
+				os << "null";
+		}
+		os << " }";
+	}
+	os << endl << "  ]," << endl;
+	os << "  \"sysfs_caches\": [";
+	for (size_t i = 0; i < caches.size(); i++)
+	{
+		os << (i ? "," : "") << endl
+		   << "    { \"level\": " << caches[i].level << ", \"type\": \"" << caches[i].type
+		   << "\", \"size\": " << caches[i].size << ", \"line_size\": " << caches[i].line_size
+		   << ", \"ways\": " << caches[i].ways << ", \"sets\": " << caches[i].sets
+		   << ", \"shared_cpu_list\": \"" << caches[i].shared_cpus << "\" }";
+	}
+	os << endl << "  ]" << endl << "}" << endl;
 }
 
-int main()
+// usage: cache_test [-c cpu] [-n trials] [-o topology.json] [-b threads]
+//        cache_test [-c cpu] [-n trials] -f footprint [-s stride]   one chase, prints ns/load
+//        cache_test [-c cpu] [-n trials] -t 1                       TLB reach and page walks
+// -n sets the timed trials per measured point (default 5)
+// -b runs the bandwidth and prefetcher suite on 1..threads threads (0 = all CPUs)
+int main(int argc, char *argv[])
 {
-	SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS);
-	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
-	L1_cache_size = L1_DCache_Size();
-	L2_cache_size = L2_Cache_Size();
-	L1_cache_block = L1_DCache_Block();
-	L2_cache_block = L2_Cache_Block();
-	L1_way_count = L1_DCache_Way_Count();
-	L2_way_count = L2_Cache_Way_Count();
+	int cpu = 0;
+	string output = "cache_topology.json";
+	long footprint = 0, stride = 64;
+	int bandwidth_threads = -1;
+	bool tlb = false;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (string(argv[i]) == "-c")
+			cpu = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "-o")
+			output = argv[i + 1];
+		else if (string(argv[i]) == "-f")
+			footprint = atol(argv[i + 1]);
+		else if (string(argv[i]) == "-s")
+			stride = atol(argv[i + 1]);
+		else if (string(argv[i]) == "-b")
+			bandwidth_threads = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "-t")
+			tlb = atoi(argv[i + 1]) != 0;
+		else if (string(argv[i]) == "-n")
+			trial_count = max(1, atoi(argv[i + 1]));
+	}
+
+	Pin_To_Cpu(cpu);
+	Open_Miss_Counters();
+	test_array = Alloc_Test_Array();
+	if (test_array == NULL)
+	{
+		cerr << "cannot allocate the test array" << endl;
+		return 1;
+	}
+	memset(test_array, 0, ARRAY_SIZE);
+	cout << "Test array pages: " << array_pages << endl;
+	cout << "Miss counters: " << (miss_fds[0] >= 0 ? "perf_event" : "unavailable") << endl;
+
+	if (footprint > 0)
+	{
+		if (footprint > ARRAY_SIZE || stride < (long)sizeof(void *) || stride % sizeof(void *))
+		{
+			cerr << "footprint must fit the test array and stride be a multiple of the pointer size" << endl;
+			return 1;
+		}
+		cout << footprint << " bytes, stride " << stride << ": "
+			 << Measure([&](int seed) { return Chase_Latency(footprint, stride, seed); })
+			 << " (ns/load, 95% CI, trials kept)" << endl;
+		return 0;
+	}
+
+	if (tlb)
+	{
+		Test_Tlb();
+		return 0;
+	}
+
+	Test_Cache_Size();
+	for (size_t i = 0; i < levels.size() && i < 2; i++)
+	{
+		levels[i].block = Test_Cache_Block((int)i);
+		levels[i].ways = Test_Cache_Way_Count((int)i);
+	}
+
+	vector<SysfsCache> caches = Read_Sysfs_Caches(cpu);
+	ofstream out(output.c_str());
+	Write_Topology(out, cpu, caches);
+	cout << "Topology written to " << output << endl;
+
+	if (bandwidth_threads >= 0)
+		Test_Bandwidth(cpu, bandwidth_threads ? bandwidth_threads : (int)thread::hardware_concurrency());
+#ifdef _WIN32
 	system("pause");
+#endif
 	return 0;
 }
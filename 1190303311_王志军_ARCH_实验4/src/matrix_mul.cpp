@@ -1,20 +1,1647 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <stdlib.h>
 #include <string.h>
 #include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
 #include <time.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#ifdef __linux__
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
 using   namespace   std;   
 
-int main()
+// milliseconds on a monotonic wall clock; clock() counts CPU ticks, and
+// those are neither milliseconds on Linux nor wall time once threads run
+double Now_Ms()
 {
-	clock_t start, finish;
-	clock_t start1, finish1;
+	return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// cache parameters used to size the GEMM blocks
+struct CacheInfo
+{
+	long l1_size;
+	long l2_size;
+	long l3_size;
+	int l1_ways;
+	int l2_ways;
+	int l3_ways;
+	int line_size;
+};
+
+// read the data cache sizes from the C library, falling back to common
+// desktop values (32KB / 256KB / 8MB, 8/8/16 ways, 64B lines) where they
+// are not reported
+CacheInfo Detect_Cache_Info()
+{
+	CacheInfo info;
+	info.l1_size = 32 << 10;
+	info.l2_size = 256 << 10;
+	info.l3_size = 8 << 20;
+	info.l1_ways = 8;
+	info.l2_ways = 8;
+	info.l3_ways = 16;
+	info.line_size = 64;
+#if defined(__linux__) && defined(_SC_LEVEL1_DCACHE_SIZE)
+	long size;
+	if ((size = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0)
+		info.l1_size = size;
+	if ((size = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+		info.l2_size = size;
+	if ((size = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0)
+		info.l3_size = size;
+	if ((size = sysconf(_SC_LEVEL1_DCACHE_ASSOC)) > 0)
+		info.l1_ways = (int)size;
+	if ((size = sysconf(_SC_LEVEL2_CACHE_ASSOC)) > 0)
+		info.l2_ways = (int)size;
+	if ((size = sysconf(_SC_LEVEL3_CACHE_ASSOC)) > 0)
+		info.l3_ways = (int)size;
+	if ((size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0)
+		info.line_size = (int)size;
+#endif
+	return info;
+}
+
+// register block of the portable micro-kernel: MR rows of A times NR columns of B
+#define GEMM_MR 4
+#define GEMM_NR 8
+
+// a micro-kernel computes C[0:mr][0:nr] += Ap * Bp for one packed MR*kc sliver
+// of A and one packed kc*NR sliver of B; mr/nr are smaller only at the edges
+template <typename T>
+struct GemmKernel
+{
+	const char *name;
+	int mr;
+	int nr;
+	void (*run)(int kc, const T *Ap, const T *Bp, T *C, int ldc, int mr, int nr);
+};
+
+// cache blocks of the GEMM loop nest (BLIS naming)
+//   kc: depth of a packed panel, an MR*kc sliver of A plus an NR*kc sliver of B stay in L1
+//   mc: rows of A packed per block, the mc*kc block of A stays in L2
+//   nc: columns of B packed per panel, the kc*nc panel of B stays in L3
+// and the loop order of the macro-kernel around the micro-kernel
+struct GemmBlocking
+{
+	int mc;
+	int nc;
+	int kc;
+	int order;
+};
+
+#define GEMM_ORDER_JR_IR 0	// a B sliver stays in L1 while the A block streams from L2
+#define GEMM_ORDER_IR_JR 1	// an A sliver stays in L1 while the B panel streams from L3
+
+int Round_Down(long value, int multiple, int minimum)
+{
+	long result = value / multiple * multiple;
+	return result < minimum ? minimum : (int)result;
+}
+
+#define GEMM_MAX_MC 512	// servers report a many-MB L2 or a whole-socket L3, so
+#define GEMM_MAX_NC 4096	// mc and nc are capped near the usual BLIS sizes
+
+// derive the block sizes from the cache sizes, using half of each level
+// so the streamed operand and C do not evict the resident block
+template <typename T>
+GemmBlocking Gemm_Blocking(const CacheInfo &info, const GemmKernel<T> &kern)
+{
+	GemmBlocking blk;
+	blk.kc = Round_Down(info.l1_size / 2 / ((kern.mr + kern.nr) * (long)sizeof(T)), 8, 64);
+	long mc = info.l2_size / 2 / (blk.kc * (long)sizeof(T));
+	long nc = info.l3_size / 2 / (blk.kc * (long)sizeof(T));
+	blk.mc = Round_Down(mc < GEMM_MAX_MC ? mc : GEMM_MAX_MC, kern.mr, kern.mr);
+	blk.nc = Round_Down(nc < GEMM_MAX_NC ? nc : GEMM_MAX_NC, kern.nr, kern.nr);
+	blk.order = GEMM_ORDER_JR_IR;
+	return blk;
+}
+
+// copy a kc*nc panel of B into NR-wide column slivers, zero padding the last one
+template <typename T>
+void Pack_B(int kc, int nc, const T *B, int ldb, T *Bp, int NR)
+{
+	for (int jr = 0; jr < nc; jr += NR)
+	{
+		int nr = nc - jr < NR ? nc - jr : NR;
+		for (int p = 0; p < kc; p++)
+		{
+			const T *row = B + (long)p * ldb + jr;
+			for (int j = 0; j < nr; j++)
+				Bp[j] = row[j];
+			for (int j = nr; j < NR; j++)
+				Bp[j] = 0;
+			Bp += NR;
+		}
+	}
+}
+
+// copy an mc*kc block of A into MR-tall row slivers, zero padding the last one
+template <typename T>
+void Pack_A(int mc, int kc, const T *A, int lda, T *Ap, int MR)
+{
+	for (int ir = 0; ir < mc; ir += MR)
+	{
+		int mr = mc - ir < MR ? mc - ir : MR;
+		for (int p = 0; p < kc; p++)
+		{
+			for (int i = 0; i < mr; i++)
+				Ap[i] = A[(long)(ir + i) * lda + p];
+			for (int i = mr; i < MR; i++)
+				Ap[i] = 0;
+			Ap += MR;
+		}
+	}
+}
+
+// portable micro-kernel, with the MR*NR accumulators left to the compiler
+template <typename T>
+void Micro_Kernel(int kc, const T *Ap, const T *Bp, T *C, int ldc, int mr, int nr)
+{
+	T acc[GEMM_MR][GEMM_NR];
+	for (int i = 0; i < GEMM_MR; i++)
+		for (int j = 0; j < GEMM_NR; j++)
+			acc[i][j] = 0;
+
+	for (int p = 0; p < kc; p++)
+	{
+		for (int i = 0; i < GEMM_MR; i++)
+		{
+			T a = Ap[i];
+			for (int j = 0; j < GEMM_NR; j++)
+				acc[i][j] += a * Bp[j];
+		}
+		Ap += GEMM_MR;
+		Bp += GEMM_NR;
+	}
+
+	for (int i = 0; i < mr; i++)
+		for (int j = 0; j < nr; j++)
+			C[(long)i * ldc + j] += acc[i][j];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86_SIMD
+#include <immintrin.h>
+
+// Vector operations per instruction set and element type. W is the number of
+// elements per register; madd(acc, a, b) returns acc + a * b (fused for
+// floating point where FMA is available).
+#define SSE41_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+
+template <typename T> struct Sse41;
+template <typename T> struct Avx2;
+template <typename T> struct Avx512;
+
+template <> struct Sse41<int>
+{
+	typedef int T; typedef __m128i V; enum { W = 4 };
+	static SSE41_TARGET V zero() { return _mm_setzero_si128(); }
+	static SSE41_TARGET V set1(T a) { return _mm_set1_epi32(a); }
+	static SSE41_TARGET V load(const T *p) { return _mm_loadu_si128((const __m128i *)p); }
+	static SSE41_TARGET void store(T *p, V v) { _mm_storeu_si128((__m128i *)p, v); }
+	static SSE41_TARGET V add(V a, V b) { return _mm_add_epi32(a, b); }
+	static SSE41_TARGET V madd(V c, V a, V b) { return _mm_add_epi32(c, _mm_mullo_epi32(a, b)); }
+};
+
+template <> struct Sse41<float>
+{
+	typedef float T; typedef __m128 V; enum { W = 4 };
+	static SSE41_TARGET V zero() { return _mm_setzero_ps(); }
+	static SSE41_TARGET V set1(T a) { return _mm_set1_ps(a); }
+	static SSE41_TARGET V load(const T *p) { return _mm_loadu_ps(p); }
+	static SSE41_TARGET void store(T *p, V v) { _mm_storeu_ps(p, v); }
+	static SSE41_TARGET V add(V a, V b) { return _mm_add_ps(a, b); }
+	static SSE41_TARGET V madd(V c, V a, V b) { return _mm_add_ps(c, _mm_mul_ps(a, b)); }
+};
+
+template <> struct Sse41<double>
+{
+	typedef double T; typedef __m128d V; enum { W = 2 };
+	static SSE41_TARGET V zero() { return _mm_setzero_pd(); }
+	static SSE41_TARGET V set1(T a) { return _mm_set1_pd(a); }
+	static SSE41_TARGET V load(const T *p) { return _mm_loadu_pd(p); }
+	static SSE41_TARGET void store(T *p, V v) { _mm_storeu_pd(p, v); }
+	static SSE41_TARGET V add(V a, V b) { return _mm_add_pd(a, b); }
+	static SSE41_TARGET V madd(V c, V a, V b) { return _mm_add_pd(c, _mm_mul_pd(a, b)); }
+};
+
+template <> struct Avx2<int>
+{
+	typedef int T; typedef __m256i V; enum { W = 8 };
+	static AVX2_TARGET V zero() { return _mm256_setzero_si256(); }
+	static AVX2_TARGET V set1(T a) { return _mm256_set1_epi32(a); }
+	static AVX2_TARGET V load(const T *p) { return _mm256_loadu_si256((const __m256i *)p); }
+	static AVX2_TARGET void store(T *p, V v) { _mm256_storeu_si256((__m256i *)p, v); }
+	static AVX2_TARGET V add(V a, V b) { return _mm256_add_epi32(a, b); }
+	static AVX2_TARGET V madd(V c, V a, V b) { return _mm256_add_epi32(c, _mm256_mullo_epi32(a, b)); }
+};
+
+template <> struct Avx2<float>
+{
+	typedef float T; typedef __m256 V; enum { W = 8 };
+	static AVX2_TARGET V zero() { return _mm256_setzero_ps(); }
+	static AVX2_TARGET V set1(T a) { return _mm256_set1_ps(a); }
+	static AVX2_TARGET V load(const T *p) { return _mm256_loadu_ps(p); }
+	static AVX2_TARGET void store(T *p, V v) { _mm256_storeu_ps(p, v); }
+	static AVX2_TARGET V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static AVX2_TARGET V madd(V c, V a, V b) { return _mm256_fmadd_ps(a, b, c); }
+};
+
+template <> struct Avx2<double>
+{
+	typedef double T; typedef __m256d V; enum { W = 4 };
+	static AVX2_TARGET V zero() { return _mm256_setzero_pd(); }
+	static AVX2_TARGET V set1(T a) { return _mm256_set1_pd(a); }
+	static AVX2_TARGET V load(const T *p) { return _mm256_loadu_pd(p); }
+	static AVX2_TARGET void store(T *p, V v) { _mm256_storeu_pd(p, v); }
+	static AVX2_TARGET V add(V a, V b) { return _mm256_add_pd(a, b); }
+	static AVX2_TARGET V madd(V c, V a, V b) { return _mm256_fmadd_pd(a, b, c); }
+};
+
+template <> struct Avx512<int>
+{
+	typedef int T; typedef __m512i V; enum { W = 16 };
+	static AVX512_TARGET V zero() { return _mm512_setzero_si512(); }
+	static AVX512_TARGET V set1(T a) { return _mm512_set1_epi32(a); }
+	static AVX512_TARGET V load(const T *p) { return _mm512_loadu_si512(p); }
+	static AVX512_TARGET void store(T *p, V v) { _mm512_storeu_si512(p, v); }
+	static AVX512_TARGET V add(V a, V b) { return _mm512_add_epi32(a, b); }
+	static AVX512_TARGET V madd(V c, V a, V b) { return _mm512_add_epi32(c, _mm512_mullo_epi32(a, b)); }
+};
+
+template <> struct Avx512<float>
+{
+	typedef float T; typedef __m512 V; enum { W = 16 };
+	static AVX512_TARGET V zero() { return _mm512_setzero_ps(); }
+	static AVX512_TARGET V set1(T a) { return _mm512_set1_ps(a); }
+	static AVX512_TARGET V load(const T *p) { return _mm512_loadu_ps(p); }
+	static AVX512_TARGET void store(T *p, V v) { _mm512_storeu_ps(p, v); }
+	static AVX512_TARGET V add(V a, V b) { return _mm512_add_ps(a, b); }
+	static AVX512_TARGET V madd(V c, V a, V b) { return _mm512_fmadd_ps(a, b, c); }
+};
+
+template <> struct Avx512<double>
+{
+	typedef double T; typedef __m512d V; enum { W = 8 };
+	static AVX512_TARGET V zero() { return _mm512_setzero_pd(); }
+	static AVX512_TARGET V set1(T a) { return _mm512_set1_pd(a); }
+	static AVX512_TARGET V load(const T *p) { return _mm512_loadu_pd(p); }
+	static AVX512_TARGET void store(T *p, V v) { _mm512_storeu_pd(p, v); }
+	static AVX512_TARGET V add(V a, V b) { return _mm512_add_pd(a, b); }
+	static AVX512_TARGET V madd(V c, V a, V b) { return _mm512_fmadd_pd(a, b, c); }
+};
+
+// One micro-kernel body per instruction set: MR rows times NV registers of
+// B per row are kept as accumulators for the whole kc loop. The body is the
+// same for every ISA; only the target attribute differs, and that has to be
+// spelled on the function itself for the intrinsics to be inlined.
+#define DEFINE_SIMD_MICRO_KERNEL(NAME, TARGET)                                         \
+	template <class S, int MR, int NV>                                                  \
+	TARGET void NAME(int kc, const typename S::T *Ap, const typename S::T *Bp,         \
+					 typename S::T *C, int ldc, int mr, int nr)                         \
+	{                                                                                   \
+		typedef typename S::T T;                                                        \
+		typedef typename S::V V;                                                        \
+		V acc[MR][NV];                                                                  \
+		for (int i = 0; i < MR; i++)                                                    \
+			for (int j = 0; j < NV; j++)                                                \
+				acc[i][j] = S::zero();                                                  \
+		for (int p = 0; p < kc; p++)                                                    \
+		{                                                                               \
+			V b[NV];                                                                    \
+			for (int j = 0; j < NV; j++)                                                \
+				b[j] = S::load(Bp + j * S::W);                                          \
+			for (int i = 0; i < MR; i++)                                                \
+			{                                                                           \
+				V a = S::set1(Ap[i]);                                                   \
+				for (int j = 0; j < NV; j++)                                            \
+					acc[i][j] = S::madd(acc[i][j], a, b[j]);                            \
+			}                                                                           \
+			Ap += MR;                                                                   \
+			Bp += NV * S::W;                                                            \
+		}                                                                               \
+		if (mr == MR && nr == NV * S::W)                                                \
+		{                                                                               \
+			for (int i = 0; i < MR; i++)                                                \
+				for (int j = 0; j < NV; j++)                                            \
+				{                                                                       \
+					T *c = C + (long)i * ldc + j * S::W;                                \
+					S::store(c, S::add(S::load(c), acc[i][j]));                         \
+				}                                                                       \
+			return;                                                                     \
+		}                                                                               \
+		T tile[MR][NV * S::W];                                                          \
+		for (int i = 0; i < MR; i++)                                                    \
+			for (int j = 0; j < NV; j++)                                                \
+				S::store(&tile[i][j * S::W], acc[i][j]);                                \
+		for (int i = 0; i < mr; i++)                                                    \
+			for (int j = 0; j < nr; j++)                                                \
+				C[(long)i * ldc + j] += tile[i][j];                                     \
+	}
+
+DEFINE_SIMD_MICRO_KERNEL(Micro_Kernel_Sse41, SSE41_TARGET)
+DEFINE_SIMD_MICRO_KERNEL(Micro_Kernel_Avx2, AVX2_TARGET)
+DEFINE_SIMD_MICRO_KERNEL(Micro_Kernel_Avx512, AVX512_TARGET)
+#endif
+
+template <typename T>
+GemmKernel<T> Make_Kernel(const char *name, int mr, int nr,
+						  void (*run)(int, const T *, const T *, T *, int, int, int))
+{
+	GemmKernel<T> kern;
+	kern.name = name;
+	kern.mr = mr;
+	kern.nr = nr;
+	kern.run = run;
+	return kern;
+}
+
+#define GEMM_MAX_KERNELS 4
+
+// fill list with the micro-kernels this CPU can run, fastest first;
+// the cpuid checks also confirm the OS saves the wider register state
+template <typename T>
+int Gemm_Kernels(GemmKernel<T> *list)
+{
+	int n = 0;
+#ifdef GEMM_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		list[n++] = Make_Kernel<T>("avx512", 6, 2 * Avx512<T>::W, Micro_Kernel_Avx512<Avx512<T>, 6, 2>);
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		list[n++] = Make_Kernel<T>("avx2", 6, 2 * Avx2<T>::W, Micro_Kernel_Avx2<Avx2<T>, 6, 2>);
+	if (__builtin_cpu_supports("sse4.1"))
+		list[n++] = Make_Kernel<T>("sse4.1", 4, 2 * Sse41<T>::W, Micro_Kernel_Sse41<Sse41<T>, 4, 2>);
+#endif
+	list[n++] = Make_Kernel<T>("scalar", GEMM_MR, GEMM_NR, Micro_Kernel<T>);
+	return n;
+}
+
+#define KERNEL_TIME_KC 256		// depth of the panels a candidate kernel is timed on
+#define KERNEL_TIME_CALLS 2000	// micro-kernel calls per timed run
+
+// MACs per ms of one micro-kernel on L1-resident panels, best of three runs
+template <typename T>
+double Kernel_Throughput(const GemmKernel<T> &kern)
+{
+	vector<T> Ap((long)kern.mr * KERNEL_TIME_KC, (T)1);
+	vector<T> Bp((long)kern.nr * KERNEL_TIME_KC, (T)1);
+	vector<T> C((long)kern.mr * kern.nr, (T)0);
+	double best = 0;
+	for (int r = 0; r < 3; r++)
+	{
+		double begin = Now_Ms();
+		for (int i = 0; i < KERNEL_TIME_CALLS; i++)
+			kern.run(KERNEL_TIME_KC, Ap.data(), Bp.data(), C.data(), kern.nr, kern.mr, kern.nr);
+		double ms = Now_Ms() - begin;
+		double rate = (double)kern.mr * kern.nr * KERNEL_TIME_KC * KERNEL_TIME_CALLS / (ms > 0 ? ms : 1e-6);
+		best = rate > best ? rate : best;
+	}
+	return best;
+}
+
+// the fastest kernel for the running CPU: every supported kernel is timed
+// once on first use and the winner is kept for the rest of the run
+template <typename T>
+int Gemm_Fastest_Kernel(const GemmKernel<T> *list, int count)
+{
+	int best = 0;
+	double best_rate = 0;
+	for (int i = 0; i < count; i++)
+	{
+		double rate = Kernel_Throughput(list[i]);
+		if (rate > best_rate)
+		{
+			best = i;
+			best_rate = rate;
+		}
+	}
+	return best;
+}
+
+template <typename T>
+const GemmKernel<T> &Gemm_Best_Kernel()
+{
+	static GemmKernel<T> list[GEMM_MAX_KERNELS];
+	static int fastest = Gemm_Fastest_Kernel(list, Gemm_Kernels(list));
+	return list[fastest];
+}
+
+// C(M*N) += A(M*K) * B(K*N), all row-major with leading dimensions lda/ldb/ldc
+template <typename T>
+void Gemm_Blocked(int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc,
+				  const GemmBlocking &blk, const GemmKernel<T> &kern)
+{
+	T *Ap = new T[(long)blk.mc * blk.kc];
+	T *Bp = new T[(long)blk.kc * (blk.nc + kern.nr)];
+
+	for (int jc = 0; jc < N; jc += blk.nc)
+	{
+		int nc = N - jc < blk.nc ? N - jc : blk.nc;
+		for (int pc = 0; pc < K; pc += blk.kc)
+		{
+			int kc = K - pc < blk.kc ? K - pc : blk.kc;
+			Pack_B(kc, nc, B + (long)pc * ldb + jc, ldb, Bp, kern.nr);
+			for (int ic = 0; ic < M; ic += blk.mc)
+			{
+				int mc = M - ic < blk.mc ? M - ic : blk.mc;
+				Pack_A(mc, kc, A + (long)ic * lda + pc, lda, Ap, kern.mr);
+				auto tile = [&](int ir, int jr) {
+					int mr = mc - ir < kern.mr ? mc - ir : kern.mr;
+					int nr = nc - jr < kern.nr ? nc - jr : kern.nr;
+					kern.run(kc, Ap + (long)ir * kc, Bp + (long)jr * kc,
+							 C + (long)(ic + ir) * ldc + jc + jr, ldc, mr, nr);
+				};
+				if (blk.order == GEMM_ORDER_JR_IR)
+				{
+					for (int jr = 0; jr < nc; jr += kern.nr)
+						for (int ir = 0; ir < mc; ir += kern.mr)
+							tile(ir, jr);
+				}
+				else
+				{
+					for (int ir = 0; ir < mc; ir += kern.mr)
+						for (int jr = 0; jr < nc; jr += kern.nr)
+							tile(ir, jr);
+				}
+			}
+		}
+	}
+
+	delete[] Ap;
+	delete[] Bp;
+}
+
+// Run every kernel this CPU supports on the int inputs converted to T and
+// check the result against the reference c within a relative tolerance.
+// Integer results must match exactly; so must double, because every partial
+// sum of the test data stays below 2^53. Float needs room for rounding.
+template <typename T>
+bool Validate_Kernels(const char *type, int n, const int *a, const int *b, const int *c,
+					  const CacheInfo &info, double rel_tol)
+{
+	long size = (long)n * n;
+	T *ta = new T[size];
+	T *tb = new T[size];
+	T *tc = new T[size];
+	for (long i = 0; i < size; i++)
+	{
+		ta[i] = (T)a[i];
+		tb[i] = (T)b[i];
+	}
+
+	bool ok = true;
+	GemmKernel<T> list[GEMM_MAX_KERNELS];
+	int count = Gemm_Kernels(list);
+	for (int kn = 0; kn < count; kn++)
+	{
+		memset(tc, 0, size * sizeof(T));
+		double begin = Now_Ms();
+		Gemm_Blocked(n, n, n, ta, n, tb, n, tc, n, Gemm_Blocking(info, list[kn]), list[kn]);
+		double end = Now_Ms();
+
+		long bad = 0;
+		for (long i = 0; i < size; i++)
+		{
+			double diff = (double)tc[i] - (double)c[i];
+			double tol = rel_tol * (c[i] < 0 ? -c[i] : c[i]);
+			if (diff > tol || -diff > tol)
+				bad++;
+		}
+		cout << type << " " << list[kn].name << " (" << list[kn].mr << "x" << list[kn].nr << ") : "
+			 << end - begin << " ms, " << (bad ? "MISMATCH" : "ok") << endl;
+		if (bad)
+			ok = false;
+	}
+
+	delete[] ta;
+	delete[] tb;
+	delete[] tc;
+	return ok;
+}
+
+// Thread pool that runs a batch of independent tiles with work stealing.
+// The caller's thread acts as worker 0. Each batch deals the tiles to the
+// workers' deques in contiguous chunks; a worker pops from the back of its
+// own deque and, once that is empty, steals from the front of the others.
+// On Linux every worker is pinned to one CPU so first-touch placement holds;
+// the caller gets its own affinity back when the pool is destroyed.
+class TilePool
+{
+public:
+	TilePool(int threads)
+		: m_size(threads < 1 ? 1 : threads), m_queues(m_size), m_locks(m_size),
+		  m_generation(0), m_busy(0), m_stop(false), m_task(NULL)
+	{
+#ifdef __linux__
+		m_caller_pinned = pthread_getaffinity_np(pthread_self(), sizeof(m_caller_cpus), &m_caller_cpus) == 0;
+#endif
+		Pin_Thread(0);
+		for (int w = 1; w < m_size; w++)
+			m_threads.push_back(thread(&TilePool::Worker_Loop, this, w));
+	}
+
+	~TilePool()
+	{
+		{
+			lock_guard<mutex> guard(m_state);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (size_t t = 0; t < m_threads.size(); t++)
+			m_threads[t].join();
+#ifdef __linux__
+		if (m_caller_pinned)
+			pthread_setaffinity_np(pthread_self(), sizeof(m_caller_cpus), &m_caller_cpus);
+#endif
+	}
+
+	int size() const { return m_size; }
+
+	// run task(tile, worker) for every tile in [0, count) and wait for all of them
+	void run(int count, const function<void(int, int)> &task)
+	{
+		for (int w = 0; w < m_size; w++)
+		{
+			long first = (long)count * w / m_size, last = (long)count * (w + 1) / m_size;
+			for (long t = first; t < last; t++)
+				m_queues[w].push_back((int)t);
+		}
+		{
+			lock_guard<mutex> guard(m_state);
+			m_task = &task;
+			m_busy = m_size - 1;
+			m_generation++;
+		}
+		m_wake.notify_all();
+
+		Drain(0);
+
+		unique_lock<mutex> guard(m_state);
+		m_done.wait(guard, [this] { return m_busy == 0; });
+		m_task = NULL;
+	}
+
+private:
+	int m_size;
+	vector<deque<int> > m_queues;
+	vector<mutex> m_locks;
+	vector<thread> m_threads;
+
+	mutex m_state;
+	condition_variable m_wake;
+	condition_variable m_done;
+	long m_generation;
+	int m_busy;
+	bool m_stop;
+	const function<void(int, int)> *m_task;
+#ifdef __linux__
+	cpu_set_t m_caller_cpus;	// the caller's affinity before it became worker 0
+	bool m_caller_pinned;		// m_caller_cpus is valid
+#endif
+
+	void Pin_Thread(int worker)
+	{
+#ifdef __linux__
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus > 0)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(worker % cpus, &set);
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+#endif
+	}
+
+	bool Pop(int worker, int &tile)
+	{
+		lock_guard<mutex> guard(m_locks[worker]);
+		if (m_queues[worker].empty())
+			return false;
+		tile = m_queues[worker].back();
+		m_queues[worker].pop_back();
+		return true;
+	}
+
+	bool Steal(int victim, int &tile)
+	{
+		lock_guard<mutex> guard(m_locks[victim]);
+		if (m_queues[victim].empty())
+			return false;
+		tile = m_queues[victim].front();
+		m_queues[victim].pop_front();
+		return true;
+	}
+
+	// tiles never spawn tiles, so a worker is done once every deque is empty
+	void Drain(int worker)
+	{
+		int tile;
+		for (;;)
+		{
+			if (Pop(worker, tile))
+			{
+				(*m_task)(tile, worker);
+				continue;
+			}
+			bool stolen = false;
+			for (int v = 1; v < m_size && !stolen; v++)
+				stolen = Steal((worker + v) % m_size, tile);
+			if (!stolen)
+				return;
+			(*m_task)(tile, worker);
+		}
+	}
+
+	void Worker_Loop(int worker)
+	{
+		Pin_Thread(worker);
+		long seen = 0;
+		for (;;)
+		{
+			{
+				unique_lock<mutex> guard(m_state);
+				m_wake.wait(guard, [&] { return m_stop || m_generation != seen; });
+				if (m_stop)
+					return;
+				seen = m_generation;
+			}
+			Drain(worker);
+			{
+				lock_guard<mutex> guard(m_state);
+				m_busy--;
+			}
+			m_done.notify_one();
+		}
+	}
+};
+
+// count elements on pages of their own that nothing has touched yet, so
+// First_Touch decides where they live; memory from new[] may reuse pages
+// that an earlier run already placed
+template <typename T>
+T *Alloc_Untouched(long count)
+{
+#ifdef __linux__
+	void *p = mmap(NULL, count * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		throw bad_alloc();
+	return (T *)p;
+#else
+	return new T[count];
+#endif
+}
+
+template <typename T>
+void Free_Untouched(T *p, long count)
+{
+#ifdef __linux__
+	munmap(p, count * sizeof(T));
+#else
+	delete[] p;
+#endif
+}
+
+// Zero a rows*cols matrix with the pool so that each worker first touches
+// the row stripe it is dealt by Gemm_Parallel; with first-touch NUMA
+// placement the pages then live on that worker's node.
+template <typename T>
+void First_Touch(TilePool &pool, T *p, long rows, long cols)
+{
+	int n = pool.size();
+	pool.run(n, [&](int stripe, int) {
+		long r0 = rows * stripe / n, r1 = rows * (stripe + 1) / n;
+		memset(p + r0 * cols, 0, (r1 - r0) * cols * sizeof(T));
+	});
+}
+
+// C(M*N) += A(M*K) * B(K*N) with C split into tiles that are scheduled on
+// the pool. Tiles start at the cache block size and are halved until there
+// are about four per worker, so stealing can balance uneven progress.
+template <typename T>
+void Gemm_Parallel(TilePool &pool, int M, int N, int K, const T *A, int lda, const T *B, int ldb,
+				   T *C, int ldc, const GemmBlocking &blk, const GemmKernel<T> &kern)
+{
+	int tm = blk.mc, tn = blk.nc;
+	long want = 4L * pool.size();
+	while ((long)((M + tm - 1) / tm) * ((N + tn - 1) / tn) < want)
+	{
+		if (tn >= tm && tn > 4 * kern.nr)
+			tn = Round_Down(tn / 2, kern.nr, kern.nr);
+		else if (tm > 4 * kern.mr)
+			tm = Round_Down(tm / 2, kern.mr, kern.mr);
+		else
+			break;
+	}
+
+	int cols = (N + tn - 1) / tn;
+	int rows = (M + tm - 1) / tm;
+	pool.run(rows * cols, [&](int tile, int) {
+		int i0 = tile / cols * tm, j0 = tile % cols * tn;
+		int m = M - i0 < tm ? M - i0 : tm;
+		int n = N - j0 < tn ? N - j0 : tn;
+		Gemm_Blocked(m, n, K, A + (long)i0 * lda, lda, B + j0, ldb, C + (long)i0 * ldc + j0, ldc, blk, kern);
+	});
+}
+
+// time Gemm_Parallel at 1..max_threads threads and check each result against c
+bool Scaling_Report(int max_threads, int n, const int *a, const int *b, const int *c,
+					const CacheInfo &info)
+{
+	const GemmKernel<int> &kern = Gemm_Best_Kernel<int>();
+	GemmBlocking blk = Gemm_Blocking(info, kern);
+	long size = (long)n * n;
+	double base = 0;
+	bool ok = true;
+
+	cout << "threads, time (ms), speedup, efficiency" << endl;
+	for (int t = 1; t <= max_threads; t++)
+	{
+		// fresh pages for every pool, so each run's placement is its own
+		int *e = Alloc_Untouched<int>(size);
+		TilePool pool(t);
+		First_Touch(pool, e, n, n);
+		double begin = Now_Ms();
+		Gemm_Parallel(pool, n, n, n, a, n, b, n, e, n, blk, kern);
+		double ms = Now_Ms() - begin;
+		if (t == 1)
+			base = ms;
+
+		bool same = memcmp(e, c, size * sizeof(int)) == 0;
+		cout << t << ", " << ms << ", " << base / ms << ", " << base / ms / t
+			 << (same ? "" : ", MISMATCH") << endl;
+		Free_Untouched(e, size);
+		if (!same)
+			ok = false;
+	}
+	return ok;
+}
+
+/**************************************
+ * Tiling autotuner
+ *   candidate blockings are ranked by replaying their address streams
+ *   through a model of the caches, the best few are timed for real and
+ *   the winner is kept in TUNE_FILE for the machine
+**************************************/
+#define TUNE_FILE "matrix_mul.tune"
+#define TUNE_TIMED 4			// candidates timed after the model ranking
+#define TUNE_RUNS 3				// timed runs per candidate, the fastest counts
+#define TUNE_MARGIN 0.03		// how much faster than the default a candidate must be
+#define TUNE_L3_CAP (32L << 20)	// a larger L3 is modelled at this size
+
+// Set-associative LRU cache with the set/way/block logic of the lab 3
+// simulator (cacheModel.cpp), on 64-bit addresses. The number of sets is
+// rounded down to a power of two.
+class SetAssoCache
+{
+public:
+	SetAssoCache(long size, int ways, int line)
+		: m_sets_log(0), m_blksz_log(0), m_ass(ways)
+	{
+		while ((1 << (m_blksz_log + 1)) <= line)
+			m_blksz_log++;
+		while ((2L << m_sets_log) * ways * line <= size)
+			m_sets_log++;
+		long blocks = (1L << m_sets_log) * ways;
+		m_tags.assign(blocks, 0);
+		m_valids.assign(blocks, 0);
+		m_replace_q.resize(blocks);
+		for (long i = 0; i < blocks; i++)
+			m_replace_q[i] = i;
+	}
+
+	// true on a hit; a miss replaces the least recently used block of the set
+	bool access(unsigned long long addr)
+	{
+		unsigned long long tag = addr >> (m_blksz_log + m_sets_log);
+		long first = (long)((addr >> m_blksz_log) & ((1UL << m_sets_log) - 1)) * m_ass;
+		for (int i = 0; i < m_ass; i++)
+			if (m_valids[first + i] && m_tags[first + i] == tag)
+			{
+				updateReplaceQ(first, first + i);
+				return true;
+			}
+		long victim = m_replace_q[first];
+		m_tags[victim] = tag;
+		m_valids[victim] = 1;
+		updateReplaceQ(first, victim);
+		return false;
+	}
+
+private:
+	int m_sets_log;
+	int m_blksz_log;
+	int m_ass;
+	vector<unsigned long long> m_tags;
+	vector<char> m_valids;
+	vector<long> m_replace_q;	// per set, least recently used first
+
+	void updateReplaceQ(long first, long blk_id)
+	{
+		for (int i = 0; i < m_ass; i++)
+			if (m_replace_q[first + i] == blk_id)
+			{
+				for (int j = i; j < m_ass - 1; j++)
+					m_replace_q[first + j] = m_replace_q[first + j + 1];
+				m_replace_q[first + m_ass - 1] = blk_id;
+				return;
+			}
+	}
+};
+
+// L1, L2 and L3 chained without inclusion; counts the cycles that accesses
+// spend beyond L1 at nominal load-to-use latencies of an L2 hit (14), an
+// L3 hit (50) and memory (200)
+class CacheCostModel
+{
+public:
+	CacheCostModel(const CacheInfo &info)
+		: m_l1(info.l1_size, info.l1_ways, info.line_size),
+		  m_l2(info.l2_size, info.l2_ways, info.line_size),
+		  m_l3(info.l3_size < TUNE_L3_CAP ? info.l3_size : TUNE_L3_CAP, info.l3_ways, info.line_size),
+		  m_line(info.line_size), m_cycles(0) {}
+
+	// access every line of [addr, addr + bytes)
+	void touch(unsigned long long addr, long bytes)
+	{
+		for (unsigned long long line = addr / m_line * m_line; line < addr + bytes; line += m_line)
+			if (!m_l1.access(line))
+				m_cycles += m_l2.access(line) ? 14 : m_l3.access(line) ? 50 : 200;
+	}
+
+	double cycles() { return m_cycles; }
+
+private:
+	SetAssoCache m_l1, m_l2, m_l3;
+	int m_line;
+	double m_cycles;
+};
+
+// Replay the accesses of Gemm_Blocked for its first (jc, pc) iteration,
+// the steady state of the loop nest, at line granularity: Pack_B, then for
+// every mc block Pack_A and the micro-kernel calls in the candidate's
+// loop order, each of which reads its A and B slivers and updates its C
+// tile. Returns the modelled cycles beyond L1 per multiply-add.
+template <typename T>
+double Tune_Model_Cost(int M, int N, int K, const GemmBlocking &blk, const GemmKernel<T> &kern,
+					   const CacheInfo &info)
+{
+	CacheCostModel model(info);
+	long S = sizeof(T), page = 4096;
+	int nc = N < blk.nc ? N : blk.nc, kc = K < blk.kc ? K : blk.kc;
+	unsigned long long A = 0;
+	unsigned long long B = (A + (long)M * K * S + page) / page * page;
+	unsigned long long C = (B + (long)K * N * S + page) / page * page;
+	unsigned long long Ap = (C + (long)M * N * S + page) / page * page;
+	unsigned long long Bp = (Ap + (long)blk.mc * kc * S + page) / page * page;
+
+	for (int jr = 0; jr < nc; jr += kern.nr)
+		for (int p = 0; p < kc; p++)
+		{
+			model.touch(B + ((long)p * N + jr) * S, (nc - jr < kern.nr ? nc - jr : kern.nr) * S);
+			model.touch(Bp + ((long)jr * kc + (long)p * kern.nr) * S, kern.nr * S);
+		}
+	for (int ic = 0; ic < M; ic += blk.mc)
+	{
+		int mc = M - ic < blk.mc ? M - ic : blk.mc;
+		for (int ir = 0; ir < mc; ir += kern.mr)
+			for (int p = 0; p < kc; p++)
+			{
+				for (int i = 0; i < kern.mr && ir + i < mc; i++)
+					model.touch(A + ((long)(ic + ir + i) * K + p) * S, S);
+				model.touch(Ap + ((long)ir * kc + (long)p * kern.mr) * S, kern.mr * S);
+			}
+		auto tile = [&](int ir, int jr) {
+			model.touch(Ap + (long)ir * kc * S, (long)kc * kern.mr * S);
+			model.touch(Bp + (long)jr * kc * S, (long)kc * kern.nr * S);
+			for (int i = 0; i < kern.mr && ir + i < mc; i++)
+				model.touch(C + ((long)(ic + ir + i) * N + jr) * S, (nc - jr < kern.nr ? nc - jr : kern.nr) * S);
+		};
+		if (blk.order == GEMM_ORDER_JR_IR)
+		{
+			for (int jr = 0; jr < nc; jr += kern.nr)
+				for (int ir = 0; ir < mc; ir += kern.mr)
+					tile(ir, jr);
+		}
+		else
+		{
+			for (int ir = 0; ir < mc; ir += kern.mr)
+				for (int jr = 0; jr < nc; jr += kern.nr)
+					tile(ir, jr);
+		}
+	}
+	return model.cycles() / ((double)M * nc * kc);
+}
+
+// CPU model and cache sizes, so a tune file copied to another machine is
+// searched again instead of trusted
+string Machine_Key(const CacheInfo &info)
+{
+	string cpu = "unknown";
+#ifdef __linux__
+	ifstream in("/proc/cpuinfo");
+	string line;
+	while (getline(in, line))
+		if (line.compare(0, 10, "model name") == 0)
+		{
+			cpu = line.substr(line.find(':') + 2);
+			break;
+		}
+#endif
+	ostringstream key;
+	key << cpu << "|" << info.l1_size << "/" << info.l2_size << "/" << info.l3_size;
+	string s = key.str();
+	replace(s.begin(), s.end(), ' ', '_');
+	return s;
+}
+
+// TUNE_FILE holds one "key mc nc kc order" line per tuned configuration
+bool Load_Tuning(const string &key, GemmBlocking &blk)
+{
+	ifstream in(TUNE_FILE);
+	string k;
+	GemmBlocking b;
+	while (in >> k >> b.mc >> b.nc >> b.kc >> b.order)
+		if (k == key)
+		{
+			blk = b;
+			return true;
+		}
+	return false;
+}
+
+void Save_Tuning(const string &key, const GemmBlocking &blk)
+{
+	vector<string> lines;
+	ifstream in(TUNE_FILE);
+	string line;
+	while (getline(in, line))
+		if (line.compare(0, key.size() + 1, key + " ") != 0)
+			lines.push_back(line);
+	in.close();
+	ofstream out(TUNE_FILE);
+	for (size_t i = 0; i < lines.size(); i++)
+		out << lines[i] << endl;
+	out << key << " " << blk.mc << " " << blk.nc << " " << blk.kc << " " << blk.order << endl;
+}
+
+// Search kc, mc, nc and the macro-kernel loop order for C(M*N) += A*B with
+// the given kernel: rank every candidate by Tune_Model_Cost, then time the
+// default blocking and the TUNE_TIMED best on the real problem (best of
+// TUNE_RUNS runs each). A candidate replaces the default only when it is
+// faster by TUNE_MARGIN, so timing noise cannot make the tuner regress.
+template <typename T>
+GemmBlocking Autotune_Blocking(int M, int N, int K, const GemmKernel<T> &kern, const CacheInfo &info)
+{
+	int kcs[] = { 128, 192, 256, 384, 512 };
+	int mcs[] = { 8, 16, 32, 64 };		// times MR
+	int ncs[] = { 8, 32, 128 };			// times NR
+	vector<pair<double, GemmBlocking> > ranked;
+	for (int o = 0; o < 2; o++)
+		for (int kc : kcs)
+			for (int mc : mcs)
+				for (int nc : ncs)
+				{
+					GemmBlocking blk;
+					blk.kc = kc < K ? kc : K;
+					blk.mc = Round_Down(mc * kern.mr < M ? mc * kern.mr : M + kern.mr - 1, kern.mr, kern.mr);
+					blk.nc = Round_Down(nc * kern.nr < N ? nc * kern.nr : N + kern.nr - 1, kern.nr, kern.nr);
+					blk.order = o;
+					bool seen = false;
+					for (size_t i = 0; i < ranked.size(); i++)
+					{
+						const GemmBlocking &r = ranked[i].second;
+						seen = seen || (r.kc == blk.kc && r.mc == blk.mc && r.nc == blk.nc && r.order == o);
+					}
+					if (!seen)
+						ranked.push_back(make_pair(Tune_Model_Cost(M, N, K, blk, kern, info), blk));
+				}
+	sort(ranked.begin(), ranked.end(),
+		 [](const pair<double, GemmBlocking> &x, const pair<double, GemmBlocking> &y) { return x.first < y.first; });
+	if (ranked.size() > TUNE_TIMED)
+		ranked.resize(TUNE_TIMED);
+	GemmBlocking def = Gemm_Blocking(info, kern);
+	ranked.insert(ranked.begin(), make_pair(Tune_Model_Cost(M, N, K, def, kern, info), def));
+
+	T *A = new T[(long)M * K];
+	T *B = new T[(long)K * N];
+	T *C = new T[(long)M * N];
+	for (long i = 0; i < (long)M * K; i++)
+		A[i] = (T)(i % 7);
+	for (long i = 0; i < (long)K * N; i++)
+		B[i] = (T)(i % 5);
+
+	cout << "tuning " << kern.name << " blocking: mc, nc, kc, order, model cycles/MAC, time (ms)" << endl;
+	GemmBlocking best = def;
+	double best_ms = 0;
+	for (size_t i = 0; i < ranked.size(); i++)
+	{
+		const GemmBlocking &blk = ranked[i].second;
+		double ms = 0;
+		for (int r = 0; r < TUNE_RUNS; r++)
+		{
+			memset(C, 0, (long)M * N * sizeof(T));
+			double begin = Now_Ms();
+			Gemm_Blocked(M, N, K, A, K, B, N, C, N, blk, kern);
+			double t = Now_Ms() - begin;
+			ms = r == 0 || t < ms ? t : ms;
+		}
+		cout << blk.mc << ", " << blk.nc << ", " << blk.kc << ", "
+			 << (blk.order == GEMM_ORDER_JR_IR ? "jr-ir" : "ir-jr") << ", " << ranked[i].first << ", " << ms
+			 << (i == 0 ? " (default)" : "") << endl;
+		if (i == 0 || ms < best_ms * (1 - TUNE_MARGIN))
+		{
+			best = blk;
+			best_ms = ms;
+		}
+	}
+
+	delete[] A;
+	delete[] B;
+	delete[] C;
+	return best;
+}
+
+// the blocking for this problem, kernel and machine: from TUNE_FILE when
+// it has been tuned before, else searched now and saved
+template <typename T>
+GemmBlocking Tuned_Blocking(const char *type, int M, int N, int K, const GemmKernel<T> &kern,
+							const CacheInfo &info, bool retune)
+{
+	ostringstream key;
+	key << Machine_Key(info) << "|" << type << "|" << kern.name << "|" << M << "x" << N << "x" << K;
+	GemmBlocking blk;
+	if (!retune && Load_Tuning(key.str(), blk))
+		return blk;
+	blk = Autotune_Blocking(M, N, K, kern, info);
+	Save_Tuning(key.str(), blk);
+	return blk;
+}
+
+/**************************************
+ * Morton layout and cache-oblivious multiply
+ *   a matrix is stored as fixed-size tiles laid out in Z-order, so every
+ *   quadrant at every level of the recursion is contiguous; the multiply
+ *   halves M, N and K together down to one tile of each operand, and some
+ *   level of that recursion fits each cache without choosing block sizes
+**************************************/
+#define MORTON_TILE 64	// tile edge, rounded down to the micro-kernel's MR and NR
+
+// storage order inside a tile
+#define MORTON_ROW_SLIVERS 0	// slivers of rows stored column by column, as Pack_A
+#define MORTON_COL_SLIVERS 1	// slivers of columns stored row by row, as Pack_B
+
+// A rows*cols matrix in tile_rows*tile_cols tiles stored in Z-order: the
+// tile grid is covered by the smallest power-of-two square, whose quadrants
+// are laid out top left, top right, bottom left, bottom right, recursively.
+// Quadrants wholly outside the grid take no space, so the tiles are packed
+// with no gaps, storage is exactly the tile grid whatever its shape, and
+// every quadrant is still contiguous. Offsets come from a table filled by
+// walking the quadrants once. Inside a tile, elements are kept in slivers
+// of `sliver` rows or columns (see MORTON_ROW_SLIVERS); column slivers as
+// wide as the tile are plain row-major. Elements of edge tiles beyond
+// rows/cols are zero.
+template <typename T>
+class MortonMatrix
+{
+public:
+	MortonMatrix(int rows, int cols, int tile_rows, int tile_cols, int order, int sliver)
+		: m_rows(rows), m_cols(cols), m_tile_rows(tile_rows), m_tile_cols(tile_cols),
+		  m_grid_rows((rows + tile_rows - 1) / tile_rows), m_grid_cols((cols + tile_cols - 1) / tile_cols),
+		  m_order(order), m_sliver(sliver), m_tile_size((long)tile_rows * tile_cols)
+	{
+		long tiles = (long)m_grid_rows * m_grid_cols;
+		m_offset.resize(tiles);
+		int size = 1;
+		while (size < m_grid_rows || size < m_grid_cols)
+			size *= 2;
+		long next = 0;
+		place(0, 0, size, next);
+		m_data = new T[tiles * m_tile_size];
+		memset(m_data, 0, tiles * m_tile_size * sizeof(T));
+	}
+
+	~MortonMatrix() { delete[] m_data; }
+
+	int gridRows() const { return m_grid_rows; }
+	int gridCols() const { return m_grid_cols; }
+
+	T *tile(int ti, int tj) { return m_data + m_offset[(long)ti * m_grid_cols + tj]; }
+	const T *tile(int ti, int tj) const { return m_data + m_offset[(long)ti * m_grid_cols + tj]; }
+
+	void fromRowMajor(const T *src, int ld)
+	{
+		for (int ti = 0; ti < m_grid_rows; ti++)
+			for (int tj = 0; tj < m_grid_cols; tj++)
+			{
+				T *t = tile(ti, tj);
+				forTile(ti, tj, ld, [&](long at, long rm) { t[at] = src[rm]; });
+			}
+	}
+
+	void toRowMajor(T *dst, int ld) const
+	{
+		for (int ti = 0; ti < m_grid_rows; ti++)
+			for (int tj = 0; tj < m_grid_cols; tj++)
+			{
+				const T *t = tile(ti, tj);
+				forTile(ti, tj, ld, [&](long at, long rm) { dst[rm] = t[at]; });
+			}
+	}
+
+private:
+	int m_rows, m_cols;
+	int m_tile_rows, m_tile_cols;
+	int m_grid_rows, m_grid_cols;
+	int m_order, m_sliver;
+	long m_tile_size;
+	vector<long> m_offset;	// of each tile in m_data, by row-major tile index
+	T *m_data;
+
+	// give the real tiles of the size*size square at tile (i0, j0) the
+	// next offsets in Z-order
+	void place(int i0, int j0, int size, long &next)
+	{
+		if (i0 >= m_grid_rows || j0 >= m_grid_cols)
+			return;
+		if (size == 1)
+		{
+			m_offset[(long)i0 * m_grid_cols + j0] = next++ * m_tile_size;
+			return;
+		}
+		int h = size / 2;
+		place(i0, j0, h, next);
+		place(i0, j0 + h, h, next);
+		place(i0 + h, j0, h, next);
+		place(i0 + h, j0 + h, h, next);
+	}
+
+	// call f(position in the tile, position in a row-major matrix with
+	// leading dimension ld) for every real element of tile (ti, tj)
+	template <class F>
+	void forTile(int ti, int tj, int ld, F f) const
+	{
+		int i0 = ti * m_tile_rows, j0 = tj * m_tile_cols;
+		int rows = min(m_tile_rows, m_rows - i0), cols = min(m_tile_cols, m_cols - j0);
+		for (int r = 0; r < rows; r++)
+		{
+			long rm = (long)(i0 + r) * ld + j0;
+			if (m_order == MORTON_ROW_SLIVERS)
+			{
+				long at = (long)(r / m_sliver) * m_sliver * m_tile_cols + r % m_sliver;
+				for (int c = 0; c < cols; c++)
+					f(at + (long)c * m_sliver, rm + c);
+				continue;
+			}
+			for (int c0 = 0; c0 < cols; c0 += m_sliver)
+			{
+				long at = (long)c0 * m_tile_rows + (long)r * m_sliver - c0;
+				for (int c = c0; c < cols && c < c0 + m_sliver; c++)
+					f(at + c, rm + c);
+			}
+		}
+	}
+};
+
+// tile shape for kern: tm*tk tiles of A, tk*tn of B and tm*tn of C
+struct MortonShape
+{
+	int tm;
+	int tn;
+	int tk;
+};
+
+template <typename T>
+MortonShape Morton_Shape(const GemmKernel<T> &kern)
+{
+	MortonShape shape;
+	shape.tm = Round_Down(MORTON_TILE, kern.mr, kern.mr);
+	shape.tn = Round_Down(MORTON_TILE, kern.nr, kern.nr);
+	shape.tk = MORTON_TILE;
+	return shape;
+}
+
+// base case: one tile each of A, B and C. A tiles hold MR-row slivers and
+// B tiles NR-column slivers, exactly what the micro-kernel reads from its
+// packing buffers, so the tiles are multiplied in place. Edge tiles are
+// zero padded and go through the full-size kernel.
+template <typename T>
+void Morton_Tile(const T *At, const T *Bt, T *Ct, const MortonShape &shape, const GemmKernel<T> &kern)
+{
+	for (int jr = 0; jr < shape.tn; jr += kern.nr)
+		for (int ir = 0; ir < shape.tm; ir += kern.mr)
+			kern.run(shape.tk, At + (long)ir * shape.tk, Bt + (long)jr * shape.tk,
+					 Ct + (long)ir * shape.tn + jr, shape.tn, kern.mr, kern.nr);
+}
+
+// C tiles [i0, i0+size) x [j0, j0+size) += A tiles times B tiles over
+// [k0, k0+size) in the K dimension; the eight sub-products are visited so
+// that both K halves of a C quadrant run back to back. Parts of the cube
+// beyond the real grids are skipped, so sizes need not be powers of two.
+template <typename T>
+void Morton_Recurse(const MortonMatrix<T> &A, const MortonMatrix<T> &B, MortonMatrix<T> &C,
+					const MortonShape &shape, const GemmKernel<T> &kern, int i0, int j0, int k0, int size)
+{
+	if (i0 >= C.gridRows() || j0 >= C.gridCols() || k0 >= A.gridCols())
+		return;
+	if (size == 1)
+	{
+		Morton_Tile(A.tile(i0, k0), B.tile(k0, j0), C.tile(i0, j0), shape, kern);
+		return;
+	}
+	int h = size / 2;
+	for (int di = 0; di < 2; di++)
+		for (int dj = 0; dj < 2; dj++)
+			for (int dk = 0; dk < 2; dk++)
+				Morton_Recurse(A, B, C, shape, kern, i0 + di * h, j0 + dj * h, k0 + dk * h, h);
+}
+
+// C += A * B on Morton matrices built with Morton_Shape(kern): A in
+// MORTON_ROW_SLIVERS of MR, B in MORTON_COL_SLIVERS of NR, C row-major tiles
+template <typename T>
+void Morton_Multiply(const MortonMatrix<T> &A, const MortonMatrix<T> &B, MortonMatrix<T> &C,
+					 const GemmKernel<T> &kern)
+{
+	int size = 1;
+	while (size < C.gridRows() || size < C.gridCols() || size < A.gridCols())
+		size *= 2;
+	Morton_Recurse(A, B, C, Morton_Shape(kern), kern, 0, 0, 0, size);
+}
+
+// C(M*N) += A(M*K) * B(K*N) on row-major operands, converted to the Morton
+// layout and back
+template <typename T>
+void Gemm_Morton(int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc,
+				 const GemmKernel<T> &kern)
+{
+	MortonShape shape = Morton_Shape(kern);
+	MortonMatrix<T> a(M, K, shape.tm, shape.tk, MORTON_ROW_SLIVERS, kern.mr);
+	MortonMatrix<T> b(K, N, shape.tk, shape.tn, MORTON_COL_SLIVERS, kern.nr);
+	MortonMatrix<T> c(M, N, shape.tm, shape.tn, MORTON_COL_SLIVERS, shape.tn);
+	a.fromRowMajor(A, lda);
+	b.fromRowMajor(B, ldb);
+	c.fromRowMajor(C, ldc);
+	Morton_Multiply(a, b, c, kern);
+	c.toRowMajor(C, ldc);
+}
+
+/**************************************
+ * Benchmark harness
+ *   matrix_mul --bench [-m M] [-n N] [-k K] [-t int,float,double] [-l row,col]
+ *                      [-v naive,transposed,blocked,simd,threaded,morton] [-j threads]
+ *                      [-w warmup] [-r repeats] [-f csv|json]
+**************************************/
+struct BenchConfig
+{
+	int M, N, K;
+	string types;
+	string layouts;
+	string variants;
+	int threads;
+	int warmup;
+	int repeats;
+	string format;
+};
+
+struct BenchResult
+{
+	string type, layout, variant, unit;
+	double min_ms, median_ms, gops;
+	bool ok;
+};
+
+// a variant computes C(M*N) += A(M*K) * B(K*N) on row-major operands
+template <typename T>
+struct BenchVariant
+{
+	string name;
+	function<void(int, int, int, const T *, int, const T *, int, T *, int)> run;
+};
+
+bool List_Has(const string &list, const string &item)
+{
+	string padded = "," + list + ",";
+	return padded.find("," + item + ",") != string::npos;
+}
+
+// the original triple loop, walking B down its columns
+template <typename T>
+void Gemm_Naive(int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+	for (int i = 0; i < M; i++)
+		for (int j = 0; j < N; j++)
+		{
+			T temp = C[(long)i * ldc + j];
+			for (int k = 0; k < K; k++)
+				temp += A[(long)i * lda + k] * B[(long)k * ldb + j];
+			C[(long)i * ldc + j] = temp;
+		}
+}
+
+// transpose B first so the inner product reads both operands along rows
+template <typename T>
+void Gemm_Transposed(int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+	T *Bt = new T[(long)N * K];
+	for (int k = 0; k < K; k++)
+		for (int j = 0; j < N; j++)
+			Bt[(long)j * K + k] = B[(long)k * ldb + j];
+	for (int i = 0; i < M; i++)
+		for (int j = 0; j < N; j++)
+		{
+			T temp = C[(long)i * ldc + j];
+			for (int k = 0; k < K; k++)
+				temp += A[(long)i * lda + k] * Bt[(long)j * K + k];
+			C[(long)i * ldc + j] = temp;
+		}
+	delete[] Bt;
+}
+
+template <typename T>
+vector<BenchVariant<T> > Bench_Variants(TilePool &pool, const CacheInfo &info)
+{
+	// "blocked" is the portable scalar kernel; the other variants use the
+	// measured-fastest one, as the tuned path in main does
+	GemmKernel<T> list[GEMM_MAX_KERNELS];
+	int count = Gemm_Kernels(list);
+	GemmKernel<T> scalar = list[count - 1];
+	const GemmKernel<T> &best = Gemm_Best_Kernel<T>();
+	GemmBlocking scalar_blk = Gemm_Blocking(info, scalar), best_blk = Gemm_Blocking(info, best);
+
+	vector<BenchVariant<T> > variants;
+	BenchVariant<T> v;
+	v.name = "naive";
+	v.run = Gemm_Naive<T>;
+	variants.push_back(v);
+	v.name = "transposed";
+	v.run = Gemm_Transposed<T>;
+	variants.push_back(v);
+	v.name = "blocked";
+	v.run = [=](int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc) {
+		Gemm_Blocked(M, N, K, A, lda, B, ldb, C, ldc, scalar_blk, scalar);
+	};
+	variants.push_back(v);
+	v.name = "simd";
+	v.run = [=](int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc) {
+		Gemm_Blocked(M, N, K, A, lda, B, ldb, C, ldc, best_blk, best);
+	};
+	variants.push_back(v);
+	v.name = "threaded";
+	v.run = [=, &pool](int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc) {
+		Gemm_Parallel(pool, M, N, K, A, lda, B, ldb, C, ldc, best_blk, best);
+	};
+	variants.push_back(v);
+	v.name = "morton";
+	v.run = [=](int M, int N, int K, const T *A, int lda, const T *B, int ldb, T *C, int ldc) {
+		Gemm_Morton(M, N, K, A, lda, B, ldb, C, ldc, best);
+	};
+	variants.push_back(v);
+	return variants;
+}
+
+// Benchmark every selected variant for one element type and layout.
+// Operands hold small integers, so every type computes the exact same
+// product and each result is compared bit for bit with the naive one.
+// Column-major operands are multiplied as C^T = B^T * A^T in row-major.
+template <typename T>
+void Bench_Type(const BenchConfig &cfg, const string &type, const string &layout, const char *unit,
+				TilePool &pool, const CacheInfo &info, vector<BenchResult> &results)
+{
+	int M = cfg.M, N = cfg.N, K = cfg.K;
+	T *A = new T[(long)M * K];
+	T *B = new T[(long)K * N];
+	T *C = new T[(long)M * N];
+	T *ref = new T[(long)M * N];
+	unsigned seed = 12345;
+	for (long i = 0; i < (long)M * K; i++)
+		A[i] = (T)((int)((seed = seed * 1103515245 + 12345) >> 16) % 17 - 8);
+	for (long i = 0; i < (long)K * N; i++)
+		B[i] = (T)((int)((seed = seed * 1103515245 + 12345) >> 16) % 17 - 8);
+
+	bool col = layout == "col";
+	auto call = [&](const BenchVariant<T> &v, T *out) {
+		if (col)	// A is M*K with ld M, B is K*N with ld K, C is M*N with ld M
+			v.run(N, M, K, B, K, A, M, out, M);
+		else
+			v.run(M, N, K, A, K, B, N, out, N);
+	};
+
+	vector<BenchVariant<T> > variants = Bench_Variants<T>(pool, info);
+	memset(ref, 0, (long)M * N * sizeof(T));
+	call(variants[0], ref);
+
+	for (size_t vi = 0; vi < variants.size(); vi++)
+	{
+		if (!List_Has(cfg.variants, variants[vi].name))
+			continue;
+		vector<double> times;
+		for (int r = 0; r < cfg.warmup + cfg.repeats; r++)
+		{
+			memset(C, 0, (long)M * N * sizeof(T));
+			double begin = Now_Ms();
+			call(variants[vi], C);
+			double end = Now_Ms();
+			if (r >= cfg.warmup)
+				times.push_back(end - begin);
+		}
+		sort(times.begin(), times.end());
+
+		BenchResult res;
+		res.type = type;
+		res.layout = layout;
+		res.variant = variants[vi].name;
+		res.unit = unit;
+		res.min_ms = times[0];
+		res.median_ms = times.size() % 2 ? times[times.size() / 2]
+										 : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+		res.gops = 2.0 * M * N * K / (res.median_ms * 1e6);
+		res.ok = memcmp(C, ref, (long)M * N * sizeof(T)) == 0;
+		results.push_back(res);
+	}
+
+	delete[] A;
+	delete[] B;
+	delete[] C;
+	delete[] ref;
+}
+
+void Bench_Print(const BenchConfig &cfg, const vector<BenchResult> &results)
+{
+	if (cfg.format == "json")
+	{
+		cout << "{" << endl;
+		cout << "  \"benchmark\": \"matrix_mul\"," << endl;
+		cout << "  \"M\": " << cfg.M << ", \"N\": " << cfg.N << ", \"K\": " << cfg.K
+			 << ", \"threads\": " << cfg.threads << ", \"warmup\": " << cfg.warmup
+			 << ", \"repeats\": " << cfg.repeats << "," << endl;
+		cout << "  \"results\": [";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const BenchResult &r = results[i];
+			cout << (i ? "," : "") << endl
+				 << "    { \"type\": \"" << r.type << "\", \"layout\": \"" << r.layout
+				 << "\", \"variant\": \"" << r.variant << "\", \"min_ms\": " << r.min_ms
+				 << ", \"median_ms\": " << r.median_ms << ", \"rate\": " << r.gops
+				 << ", \"unit\": \"" << r.unit << "\", \"ok\": " << (r.ok ? "true" : "false") << " }";
+		}
+		cout << endl << "  ]" << endl << "}" << endl;
+		return;
+	}
+
+	cout << "type,layout,variant,M,N,K,threads,warmup,repeats,min_ms,median_ms,rate,unit,ok" << endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		cout << r.type << "," << r.layout << "," << r.variant << "," << cfg.M << "," << cfg.N << ","
+			 << cfg.K << "," << cfg.threads << "," << cfg.warmup << "," << cfg.repeats << ","
+			 << r.min_ms << "," << r.median_ms << "," << r.gops << "," << r.unit << ","
+			 << (r.ok ? 1 : 0) << endl;
+	}
+}
+
+int Bench_Main(int argc, char *argv[])
+{
+	BenchConfig cfg;
+	cfg.M = cfg.N = cfg.K = 1000;
+	cfg.types = "int,float,double";
+	cfg.layouts = "row,col";
+	cfg.variants = "naive,transposed,blocked,simd,threaded,morton";
+	cfg.threads = (int)thread::hardware_concurrency();
+	cfg.warmup = 1;
+	cfg.repeats = 5;
+	cfg.format = "csv";
+
+	for (int i = 2; i < argc; i++)
+	{
+		string opt = argv[i];
+		if (i + 1 >= argc)
+		{
+			cerr << "missing value for " << opt << endl;
+			return 1;
+		}
+		string val = argv[++i];
+		if (opt == "-m") cfg.M = atoi(val.c_str());
+		else if (opt == "-n") cfg.N = atoi(val.c_str());
+		else if (opt == "-k") cfg.K = atoi(val.c_str());
+		else if (opt == "-t") cfg.types = val;
+		else if (opt == "-l") cfg.layouts = val;
+		else if (opt == "-v") cfg.variants = val;
+		else if (opt == "-j") cfg.threads = atoi(val.c_str());
+		else if (opt == "-w") cfg.warmup = atoi(val.c_str());
+		else if (opt == "-r") cfg.repeats = atoi(val.c_str());
+		else if (opt == "-f") cfg.format = val;
+		else
+		{
+			cerr << "unknown option " << opt << endl;
+			return 1;
+		}
+	}
+	if (cfg.M < 1 || cfg.N < 1 || cfg.K < 1 || cfg.repeats < 1 || cfg.warmup < 0)
+	{
+		cerr << "sizes and repeats must be positive" << endl;
+		return 1;
+	}
+	if (cfg.threads < 1)
+		cfg.threads = 1;
+
+	TilePool pool(cfg.threads);
+	CacheInfo info = Detect_Cache_Info();
+	vector<BenchResult> results;
+	const char *layouts[] = { "row", "col" };
+	for (int l = 0; l < 2; l++)
+	{
+		if (!List_Has(cfg.layouts, layouts[l]))
+			continue;
+		if (List_Has(cfg.types, "int"))
+			Bench_Type<int>(cfg, "int", layouts[l], "GOPS", pool, info, results);
+		if (List_Has(cfg.types, "float"))
+			Bench_Type<float>(cfg, "float", layouts[l], "GFLOPS", pool, info, results);
+		if (List_Has(cfg.types, "double"))
+			Bench_Type<double>(cfg, "double", layouts[l], "GFLOPS", pool, info, results);
+	}
+	Bench_Print(cfg, results);
+
+	for (size_t i = 0; i < results.size(); i++)
+		if (!results[i].ok)
+			return 1;
+	return 0;
+}
+
+// check Gemm_Morton with every kernel against the triple loop on shapes
+// that are not multiples of the tiles, powers of two or square
+bool Validate_Morton()
+{
+	const int shapes[][3] = { { 1, 1, 1 }, { 7, 13, 5 }, { 100, 37, 201 }, { 257, 129, 65 }, { 65, 300, 130 },
+							  { 64, 20000, 64 }, { 20000, 3, 70 } };
+	GemmKernel<int> list[GEMM_MAX_KERNELS];
+	int count = Gemm_Kernels(list);
+	bool ok = true;
+	for (int kn = 0; kn < count; kn++)
+		for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+		{
+			int M = shapes[s][0], N = shapes[s][1], K = shapes[s][2];
+			vector<int> A((long)M * K), B((long)K * N), C((long)M * N), ref((long)M * N);
+			for (size_t i = 0; i < A.size(); i++)
+				A[i] = (int)(i * 7 % 19) - 9;
+			for (size_t i = 0; i < B.size(); i++)
+				B[i] = (int)(i * 5 % 23) - 11;
+			for (size_t i = 0; i < C.size(); i++)
+				C[i] = ref[i] = (int)(i % 3);
+			Gemm_Naive(M, N, K, &A[0], K, &B[0], N, &ref[0], N);
+			Gemm_Morton(M, N, K, &A[0], K, &B[0], N, &C[0], N, list[kn]);
+			if (C != ref)
+			{
+				cout << "morton " << list[kn].name << " " << M << "x" << N << "x" << K << " : MISMATCH" << endl;
+				ok = false;
+			}
+		}
+	return ok;
+}
+
+// usage: matrix_mul [--tune] [threads], threads defaults to every online CPU
+//        matrix_mul --bench [options], see Bench_Main
+// --tune searches the blocking again even if TUNE_FILE has it
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && string(argv[1]) == "--bench")
+		return Bench_Main(argc, argv);
+	bool retune = argc > 1 && string(argv[1]) == "--tune";
+	if (retune)
+	{
+		argc--;
+		argv++;
+	}
+
+	double start, finish;
+	double start1, finish1;
+
+	int threads = argc > 1 ? atoi(argv[1]) : (int)thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	TilePool pool(threads);
 
 	int i,j,k;
-	//initial two 1000*1000 matrix
+	//initial two 1000*1000 matrix, first touched by the threads that use them
 	int (*a)[1000],(*b)[1000];
 	a = new int[1000][1000];
 	b = new int[1000][1000];
+	First_Touch(pool, &a[0][0], 1000, 1000);
+	First_Touch(pool, &b[0][0], 1000, 1000);
     
 	
 	for(i = 0; i < 1000; i++)
@@ -31,10 +1658,10 @@ int main()
 	d = new int[1000][1000];
 
 	//initial 0
-	memset(c,0, 1000*1000*sizeof(int));
+	First_Touch(pool, &c[0][0], 1000, 1000);
 	memset(d,0, 1000*1000*sizeof(int));
 
-	start = clock();	
+	start = Now_Ms();	
 	for(i = 0; i < 1000; i++)
 	{
 		for(j = 0; j < 1000; j++)
@@ -46,31 +1673,20 @@ int main()
 
 		}
 	}
-	finish = clock();
-
-	start1 = clock();
+	finish = Now_Ms();
 
 	//======================================================
 	//add your own code
 	//======================================================
-	int (*b1)[1000];
-	b1 = new int[1000][1000];
-	memset(b1,0, 1000*1000*sizeof(int));
-	for(int i=0; i<1000; i++)
-		for(int j=0; j<1000; j++)
-			b1[j][i] = b[i][j];
-	for(i = 0; i < 1000; i++)
-	{
-		for(j = 0; j < 1000; j++)
-		{	int temp = 0;
-			for (k = 0; k < 1000; k++)
-			{
-				temp += a[i][k] * b1[j][k];
-			}
-			d[i][j] = temp;
-		}
-	}	
-	finish1 = clock();
+	// packed, cache-blocked GEMM with the best SIMD micro-kernel for this
+	// CPU and the blocking tuned for it (searched once, then loaded)
+	CacheInfo info = Detect_Cache_Info();
+	const GemmKernel<int> &kern = Gemm_Best_Kernel<int>();
+	GemmBlocking blk = Tuned_Blocking<int>("int", 1000, 1000, 1000, kern, info, retune);
+
+	start1 = Now_Ms();
+	Gemm_Blocked(1000, 1000, 1000, &a[0][0], 1000, &b[0][0], 1000, &d[0][0], 1000, blk, kern);
+	finish1 = Now_Ms();
 
 
 
@@ -91,6 +1707,37 @@ int main()
 
 
 	cout<<"time spent for original method : "<<finish - start<<" ms"<<endl;
-	cout<<"time spent for new method : "<<finish1 - start1<<" ms"<<endl;
+	cout<<"time spent for new method : "<<finish1 - start1<<" ms ("<<kern.name<<" kernel, mc "<<blk.mc
+		<<" nc "<<blk.nc<<" kc "<<blk.kc<<(blk.order == GEMM_ORDER_JR_IR ? " jr-ir" : " ir-jr")<<")"<<endl;
+
+	//cache-oblivious multiply on the Morton layout, conversions excluded
+	MortonShape shape = Morton_Shape(kern);
+	MortonMatrix<int> ma(1000, 1000, shape.tm, shape.tk, MORTON_ROW_SLIVERS, kern.mr);
+	MortonMatrix<int> mb(1000, 1000, shape.tk, shape.tn, MORTON_COL_SLIVERS, kern.nr);
+	MortonMatrix<int> mc(1000, 1000, shape.tm, shape.tn, MORTON_COL_SLIVERS, shape.tn);
+	ma.fromRowMajor(&a[0][0], 1000);
+	mb.fromRowMajor(&b[0][0], 1000);
+	double start2 = Now_Ms();
+	Morton_Multiply(ma, mb, mc, kern);
+	double finish2 = Now_Ms();
+	memset(d, 0, 1000*1000*sizeof(int));
+	mc.toRowMajor(&d[0][0], 1000);
+	bool ok = memcmp(c, d, 1000*1000*sizeof(int)) == 0;
+	cout<<"time spent for Morton method : "<<finish2 - start2<<" ms ("<<shape.tm<<"x"<<shape.tn<<"x"<<shape.tk
+		<<" tiles"<<(ok ? "" : ", MISMATCH")<<")"<<endl;
+	ok = Validate_Morton() && ok;
+
+	//check every kernel variant for every element type against c
+	ok = Validate_Kernels<int>("int", 1000, &a[0][0], &b[0][0], &c[0][0], info, 0) && ok;
+	ok = Validate_Kernels<float>("float", 1000, &a[0][0], &b[0][0], &c[0][0], info, 1e-5) && ok;
+	ok = Validate_Kernels<double>("double", 1000, &a[0][0], &b[0][0], &c[0][0], info, 0) && ok;
+
+	//multithreaded tile scheduler at 1..threads threads
+	ok = Scaling_Report(threads, 1000, &a[0][0], &b[0][0], &c[0][0], info) && ok;
+	if (!ok)
+	{
+		cout<<"you have got an error in algorithm modification!"<<endl;
+		exit(1);
+	}
 	return 0;
 }
@@ -0,0 +1,123 @@
+/*
+ * Checkpoint files shared by cacheModel.cpp (-savecache/-loadcache) and
+ * brchPredict.cpp (-savebp/-loadbp).
+ *
+ * A checkpoint is a CkptHeader followed by whatever the tool transfers.
+ * Saving writes the state to the file; restoring copies it out of the file
+ * mapped read-only. Both directions go through the same transfer() calls
+ * of the tool, so what is saved and what is restored cannot drift apart.
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pin.H"
+
+struct CkptHeader
+{
+    char magic[8];
+    UINT32 version;
+    UINT32 count;       // what the tool checks its layout by
+};
+
+// Moves tool state between memory and a checkpoint. After a transfer
+// fails, or a restored header or string does not match, ok is false and
+// later transfers do nothing.
+class CheckpointState
+{
+public:
+    BOOL ok;
+
+    CheckpointState() : ok(FALSE), m_file(NULL), m_map(NULL), m_size(0), m_pos(NULL), m_end(NULL) {}
+    ~CheckpointState() { close(); }
+
+    // Create path to save into
+    bool save(const std::string& path)
+    {
+        m_file = fopen(path.c_str(), "wb");
+        ok = m_file != NULL;
+        return ok;
+    }
+
+    // Map path to restore from
+    bool restore(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* map = fstat(fd, &st) == 0 && st.st_size > 0
+                  ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (map == MAP_FAILED) return false;
+        m_map = map;
+        m_size = st.st_size;
+        m_pos = (const char*)map;
+        m_end = m_pos + m_size;
+        ok = TRUE;
+        return true;
+    }
+
+    bool saving() { return m_file != NULL; }
+
+    // Close the saved file or unmap the restored one; true if every
+    // transfer succeeded
+    bool close()
+    {
+        if (m_file && fclose(m_file) != 0) ok = FALSE;
+        if (m_map) munmap(m_map, m_size);
+        m_file = NULL;
+        m_map = NULL;
+        return ok;
+    }
+
+    void transfer(void* data, size_t size)
+    {
+        if (!ok) return;
+        if (m_file)
+            ok = fwrite(data, 1, size, m_file) == size;
+        else if ((size_t)(m_end - m_pos) < size)
+            ok = FALSE;
+        else
+        {
+            memcpy(data, m_pos, size);
+            m_pos += size;
+        }
+    }
+
+    // Saving writes the header; restoring requires the saved one to be
+    // the same, so a checkpoint of another tool, version or layout is
+    // refused
+    void header(const char* magic, UINT32 version, UINT32 count)
+    {
+        CkptHeader expected;
+        memcpy(expected.magic, magic, sizeof(expected.magic));
+        expected.version = version;
+        expected.count = count;
+        CkptHeader header = expected;
+        transfer(&header, sizeof(header));
+        if (ok && memcmp(&header, &expected, sizeof(header)) != 0) ok = FALSE;
+    }
+
+    // The same for a string, such as the description of a predictor
+    void match(const std::string& s)
+    {
+        std::string saved = s;
+        if (!saved.empty()) transfer(&saved[0], saved.size());
+        if (ok && saved != s) ok = FALSE;
+    }
+
+private:
+    FILE* m_file;       // when saving
+    void* m_map;        // when restoring
+    size_t m_size;
+    const char* m_pos;
+    const char* m_end;
+};
+
+#endif
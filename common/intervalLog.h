@@ -0,0 +1,175 @@
+/*
+ * Interval statistics shared by cacheModel.cpp, brchPredict.cpp and
+ * unifiedTool.cpp.
+ *
+ * With -interval N the statistics of every N instructions are written as a
+ * row of the -ilog CSV file, so phase changes and bursts show up that the
+ * totals of Fini hide. A row is the instruction count followed by the
+ * columns of the tool, which a tool supplies as an IntervalColumns
+ * function. Rows are collected in a chunk in memory; full chunks are
+ * handed to a Pin internal thread that appends them to the file and
+ * flushes it, so the file can be followed while the program runs. The
+ * writer is stopped in PrepareForFini and the last partial interval is
+ * written by Fini.
+ */
+#ifndef INTERVAL_LOG_H
+#define INTERVAL_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include "pin.H"
+
+#define LOG_CHUNK (64 << 10)    // bytes of rows handed to the writer at once
+#define LOG_IDLE_MS 10          // writer sleep when no chunk is waiting
+
+class IntervalLog
+{
+public:
+    IntervalLog() : m_file(NULL), m_stopped(false) {}
+
+    // Create the file with its header line and start the writer
+    bool open(const std::string& path, const std::string& header)
+    {
+        m_file = fopen(path.c_str(), "w");
+        if (!m_file) return false;
+        fprintf(m_file, "%s\n", header.c_str());
+        PIN_InitLock(&m_lock);
+        return PIN_SpawnInternalThread(writerMain, this, 0, &m_uid) != INVALID_THREADID;
+    }
+
+    void append(const char* row)
+    {
+        PIN_GetLock(&m_lock, 1);
+        if (m_stopped)
+            fprintf(m_file, "%s\n", row);
+        else
+        {
+            m_chunk += row;
+            m_chunk += '\n';
+            if (m_chunk.size() >= LOG_CHUNK)
+            {
+                m_full.push_back(std::string());
+                m_full.back().swap(m_chunk);
+            }
+        }
+        PIN_ReleaseLock(&m_lock);
+    }
+
+    // Hand the remaining rows to the writer and wait for it to exit; called
+    // from PrepareForFini, while internal threads still run. Later rows are
+    // written directly.
+    void stopWriter()
+    {
+        PIN_GetLock(&m_lock, 1);
+        m_full.push_back(std::string());
+        m_full.back().swap(m_chunk);
+        m_stopped = true;
+        PIN_ReleaseLock(&m_lock);
+        PIN_WaitForThreadTermination(m_uid, PIN_INFINITE_TIMEOUT, NULL);
+    }
+
+    void close() { fclose(m_file); }
+
+private:
+    static VOID writerMain(VOID* arg)
+    {
+        IntervalLog* log = (IntervalLog*)arg;
+        for (;;)
+        {
+            std::deque<std::string> chunks;
+            PIN_GetLock(&log->m_lock, 1);
+            chunks.swap(log->m_full);
+            bool stopped = log->m_stopped;
+            PIN_ReleaseLock(&log->m_lock);
+
+            for (size_t i = 0; i < chunks.size(); i++)
+                fwrite(chunks[i].data(), 1, chunks[i].size(), log->m_file);
+            if (!chunks.empty()) fflush(log->m_file);
+            if (stopped) return;
+            if (chunks.empty()) PIN_Sleep(LOG_IDLE_MS);
+        }
+    }
+
+    FILE* m_file;
+    PIN_LOCK m_lock;
+    PIN_THREAD_UID m_uid;
+    std::string m_chunk;            // rows not yet handed over
+    std::deque<std::string> m_full; // chunks waiting for the writer
+    bool m_stopped;
+};
+
+// These knobs write interval statistics
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+        "interval", "0", "write statistics every this many instructions (0: off)");
+
+KNOB<std::string> KnobIntervalLog(KNOB_MODE_WRITEONCE, "pintool",
+        "ilog", "intervals.csv", "specify the interval statistics file name");
+
+// Append the tool's columns for an interval of ins instructions to row,
+// start its next interval and return the characters written
+typedef int (*IntervalColumns)(char* row, int size, UINT64 ins);
+
+IntervalLog* interval_log = NULL;   // with -interval
+IntervalColumns interval_columns = NULL;
+UINT64 ins_count = 0;               // instructions counted by the tool
+UINT64 next_row = 0;                // ins_count that ends the open row
+UINT64 row_ins = 0;                 // ins_count when the last row was written
+
+// Open -ilog with "instructions" and the tool's header columns; false,
+// after saying why, if the file cannot be written
+bool openIntervalLog(const std::string& header, IntervalColumns columns)
+{
+    interval_log = new IntervalLog;
+    interval_columns = columns;
+    next_row = KnobInterval.Value();
+    if (interval_log->open(KnobIntervalLog.Value(), "instructions" + header)) return true;
+    fprintf(stderr, "cannot write %s\n", KnobIntervalLog.Value().c_str());
+    return false;
+}
+
+// Write a row for the instructions since the last one; the caller holds
+// whatever lock guards the statistics the columns read
+void logInterval()
+{
+    if (ins_count == row_ins) return;
+    char row[1024];
+    int n = snprintf(row, sizeof(row), "%lu", ins_count);
+    interval_columns(row + n, sizeof(row) - n, ins_count - row_ins);
+    interval_log->append(row);
+    row_ins = ins_count;
+    next_row = ins_count - ins_count % KnobInterval.Value() + KnobInterval.Value();
+}
+
+// Write the last partial row and close the file; from Fini
+void closeIntervalLog()
+{
+    if (!interval_log) return;
+    logInterval();
+    interval_log->close();
+    delete interval_log;
+    interval_log = NULL;
+}
+
+// This function is called at every basic block entry by tools that count
+// instructions only for the rows
+VOID countIntervalBlock(UINT32 ins)
+{
+    if (ins_count >= next_row) logInterval();
+    ins_count += ins;
+}
+
+// Pin calls this function for every new trace of such a tool
+VOID IntervalTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)countIntervalBlock, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+}
+
+// Pin calls this function before Fini, while internal threads still run
+VOID IntervalPrepareForFini(VOID *v)
+{
+    if (interval_log) interval_log->stopWriter();
+}
+
+#endif